@@ -2,33 +2,233 @@
 #include <stdlib.h>
 #include <string>
 #include <map>
+#include <set>
+#include <algorithm>
 #include <stack>
 #include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include "include/ast.h"
+#include "include/session.h"
+#include "include/symtab.h"
+#include "include/builtins.h"
+#include "include/cache.h"
+#include "include/fingerprint.h"
+#include "include/timing.h"
 #include "include/stdllvm.h"
 using namespace std;
 using namespace llvm;
 
 /* Loop Structure for Break and Continue Statements */
 typedef struct Loop {
-	BasicBlock *entryBB;
+	BasicBlock *latchBB;
 	BasicBlock *afterBB;
-	PHINode *var_;
-	ASTExpressionNode *endExp;
 }loop;
 
-Module *DecafToLLVM = new Module("DecafToLLVM", getGlobalContext());
-IRBuilder<> *Builder = new IRBuilder<>(getGlobalContext());
-static map<string, Value *> symTable;
-static stack<BasicBlock *> Blocks;
-static stack<loop *> loops;
-static bool declStarted = false;
-string var;
+thread_local CompilationSession *Session;
 
-/* The Driver function to start building the IR */
-void BuildIR(ASTProgramNode *root) {
-	EvaluateVisitor v;
-	root->accept(&v);
+/*
+ * Methods are generated in batches of consecutive methods, each batch in
+ * a module of its own. A batch is the unit of work handed to a thread, so
+ * it should be big enough to amortize a module and a bitcode round trip.
+ */
+static const unsigned MinMethodsPerBatch = 8;
+
+/* One batch of methods, generated by a worker (or found in the cache) and linked by BuildIR */
+struct MethodBatch {
+	unsigned first, last;
+	string key;						// Cache key, for a batch of one method
+	string bitcode;
+	vector<string> errors;			// Type errors of the methods, which leave no bitcode
+	bool done;
+};
+
+/*
+ * Generates methods [first, last) of the program in a context and module
+ * private to the calling thread, and hands them over as bitcode : a module
+ * cannot be used from another LLVMContext directly. The declarations the
+ * methods do not use are dropped, so that the module only depends on what
+ * the methods refer to.
+ */
+static void generateBatch(ASTProgramNode *root, MethodBatch *batch) {
+	LLVMContext Context;
+	Module M("DecafToLLVM", Context);
+	{
+		EvaluateVisitor v(&M, false);
+		v.generate(root, batch->first, batch->last);
+		batch->errors = v.errors();
+	}
+	if(!batch->errors.empty()) {
+		return;
+	}
+	for(Module::iterator it = M.begin(); it != M.end(); ) {
+		Function *F = &*it++;
+		if(F->isDeclaration() && F->use_empty()) {
+			F->eraseFromParent();
+		}
+	}
+	for(Module::global_iterator it = M.global_begin(); it != M.global_end(); ) {
+		GlobalVariable *G = &*it++;
+		if(G->isDeclaration() && G->use_empty()) {
+			G->eraseFromParent();
+		}
+	}
+	raw_string_ostream os(batch->bitcode);
+	WriteBitcodeToFile(&M, os);
+	os.flush();
+}
+
+/* Prints the type errors of methods, in the format of the parser's. Returns whether there were any */
+static bool reportErrors(const char *fileName, const vector<string> &errors) {
+	for(unsigned i = 0; i < errors.size(); i++) {
+		cerr << fileName << ": ERROR: " << errors[i] << endl;
+	}
+	return !errors.empty();
+}
+
+/*
+ * The Driver function to build the IR. With more than one job, the methods
+ * are split into batches that the worker threads take in turn, each with
+ * its own LLVMContext, IRBuilder and scopes. The global fields are defined
+ * in the returned module, and every batch only declares them. Batches are
+ * linked into the result in program order as soon as they are done, so
+ * the output does not depend on the number of jobs or on scheduling.
+ *
+ * With a cache, every method is a batch of its own, keyed by its
+ * fingerprint. Methods found in the cache are linked from there, and only
+ * the others are generated (and stored).
+ *
+ * The CPU time of the worker threads is added up into *workerTimes, if
+ * given, for the time report of the calling thread.
+ */
+Module *BuildIR(ASTProgramNode *root, const char *fileName, unsigned jobs, LLVMContext &Context,
+				CompileCache *cache, PhaseTime *workerTimes) {
+	if(workerTimes) {
+		workerTimes->wall = workerTimes->user = workerTimes->system = 0;
+	}
+	Module *M = new Module("DecafToLLVM", Context);
+	unsigned numMethods = root->getMethodDeclList().size();
+	if(!llvm_is_multithreaded()) {
+		jobs = 1;
+	}
+	if(!cache && (jobs <= 1 || numMethods < 2 * MinMethodsPerBatch)) {
+		EvaluateVisitor v(M, true);
+		v.dispatch(root);
+		if(reportErrors(fileName, v.errors())) {
+			delete M;
+			return nullptr;
+		}
+		return M;
+	}
+
+	{
+		EvaluateVisitor v(M, true);
+		v.generate(root, 0, 0);			// Only the fields
+	}
+
+	vector<MethodBatch> batches;
+	vector<unsigned> todo;				// Batches to generate
+	if(cache) {
+		vector<string> fingerprints;
+		FingerprintMethods(root, fingerprints);
+		batches.resize(numMethods);
+		for(unsigned i = 0; i < numMethods; i++) {
+			batches[i].first = i;
+			batches[i].last = i + 1;
+			batches[i].key = cache->computeKey(fingerprints[i], "method IR");
+			batches[i].done = cache->lookupBlob(batches[i].key, batches[i].bitcode);
+			if(!batches[i].done) {
+				todo.push_back(i);
+			}
+		}
+	}
+	else {
+		unsigned perBatch = max(MinMethodsPerBatch, numMethods / (jobs * 4));
+		batches.resize((numMethods + perBatch - 1) / perBatch);
+		for(unsigned i = 0; i < batches.size(); i++) {
+			batches[i].first = i * perBatch;
+			batches[i].last = min(numMethods, (i + 1) * perBatch);
+			batches[i].done = false;
+			todo.push_back(i);
+		}
+	}
+
+	mutex lock;
+	condition_variable batchDone;
+	atomic<unsigned> next(0);
+	vector<thread> workers;
+	PhaseTime workerCPU;
+	workerCPU.wall = workerCPU.user = workerCPU.system = 0;
+	CompilationSession *session = Session;
+	for(unsigned t = 0; t < min<size_t>(max(jobs, 1u), todo.size()); t++) {
+		workers.push_back(thread([&]() {
+			Session = session;			// The names live in the parsing thread's session
+			PhaseTime start = ThreadTimes();
+			unsigned n;
+			while((n = next++) < todo.size()) {
+				MethodBatch &batch = batches[todo[n]];
+				generateBatch(root, &batch);
+				if(cache && batch.errors.empty()) {
+					cache->storeBlob(batch.key, batch.bitcode);
+				}
+				lock_guard<mutex> guard(lock);
+				batch.done = true;
+				batchDone.notify_all();
+			}
+			PhaseTime end = ThreadTimes();
+			lock_guard<mutex> guard(lock);
+			workerCPU.user += end.user - start.user;
+			workerCPU.system += end.system - start.system;
+		}));
+	}
+
+	bool ok = true;
+	for(unsigned i = 0; i < batches.size(); i++) {
+		{
+			unique_lock<mutex> guard(lock);
+			batchDone.wait(guard, [&]() { return batches[i].done; });
+		}
+		if(reportErrors(fileName, batches[i].errors)) {
+			ok = false;
+		}
+		if(!ok) {
+			continue;
+		}
+		ErrorOr<Module *> part = parseBitcodeFile(MemoryBufferRef(batches[i].bitcode, "batch"), Context);
+		if(!part) {
+			cerr << "Cannot read back methods " << batches[i].first << " to " << batches[i].last
+				 << ": " << part.getError().message() << endl;
+			ok = false;
+			continue;
+		}
+		if(Linker::LinkModules(M, *part)) {
+			ok = false;
+		}
+		delete *part;
+		string().swap(batches[i].bitcode);
+	}
+	for(unsigned t = 0; t < workers.size(); t++) {
+		workers[t].join();
+	}
+	if(workerTimes) {
+		*workerTimes = workerCPU;
+	}
+	if(!ok) {
+		delete M;
+		return nullptr;
+	}
+	return M;
+}
+
+/*
+ * Records a type error in the method being generated. The method of an
+ * outlined parallel loop body is the one it was written in.
+ */
+void EvaluateVisitor::error(const string &message) {
+	StringRef method = builder_.GetInsertBlock()->getParent()->getName();
+	errors_.push_back(message + " in method " + method.split('.').first.str());
 }
 
 void Error(const char *S) {
@@ -40,69 +240,90 @@ Value *ErrorV(const char *Str) {
 }
 
 /*
- * When the location is just a variable of type int or boolean,
- * we return it's AllocaInst. If it's an array, we create a Global
- * Element Pointer for required index, that is used to load the
- * contents at that index.
+ * When the location is a local variable of type int or boolean, we
+ * return its value at this point; a field is returned as its address.
+ * If it's an array, we create a Global Element Pointer for required
+ * index, that is used to load the contents at that index.
  */
 Value *EvaluateVisitor::visit(ASTVarLocationNode *node) {
-	var = node->getVar();
-	return symTable[var];
+	int var = symTable_.lookupVariable(node->getVar());
+	if(var >= 0) {
+		return readVariable(var, builder_.GetInsertBlock());
+	}
+	return symTable_.lookup(node->getVar());
 }
 
 Value *EvaluateVisitor::visit(ASTArrayLocationNode *node) {
-	var = node->getVar();
-	Value *ret = symTable[var];
-	Value *size = node->getExpression()->accept(this);
+	Value *ret = symTable_.lookup(node->getVar());
+	Value *size = dispatch(node->getExpression());
 	if(size->getType()->isPointerTy()) {
-		size = Builder->CreateLoad(size, "tmp");
+		size = builder_.CreateLoad(size, "tmp");
 	}
 	vector<Value*> v;
-	v.push_back(Builder->getInt64(0));
-	v.push_back(Builder->CreateSExt(size, Builder->getInt64Ty(), "zext"));
+	v.push_back(builder_.getInt64(0));
+	v.push_back(builder_.CreateSExt(size, builder_.getInt64Ty(), "zext"));
 	ArrayRef<Value *> a = ArrayRef<Value *>(v);
-	return Builder->CreateInBoundsGEP(ret, v, "getptr");
+	return builder_.CreateInBoundsGEP(ret, v, "getptr");
 }
 
 /*
- * Simple assignment statements. Supports '=', '+=' and '-='.
+ * Simple assignment statements. Supports '=', '+=' and '-='. A local
+ * variable gets a new value in the block the assignment ends in, other
+ * locations are stored to.
  */
 Value *EvaluateVisitor::visit(ASTAssignmentStatementNode *node) {
-	Value *ptr = node->getLocation()->accept(this);
-	Value *val = node->getExpression()->accept(this);
-	string op = node->getAssignmentOperator();
+	ASTLocationNode *loc = node->getLocation();
+	int var = loc->getKind() == AST_VAR_LOCATION ? symTable_.lookupVariable(static_cast<ASTVarLocationNode *>(loc)->getVar()) : -1;
+	if(var >= 0) {
+		Value *val = dispatch(node->getExpression());
+		if(val->getType()->isPointerTy()) {
+			val = builder_.CreateLoad(val, "tmp");
+		}
+		BasicBlock *BB = builder_.GetInsertBlock();
+		switch(node->getAssignmentOperator()) {
+			case _plusassign:
+				val = builder_.CreateAdd(readVariable(var, BB), val, "ADD");
+				break;
+			case _minusassign:
+				val = builder_.CreateSub(readVariable(var, BB), val, "ADD");
+				break;
+		}
+		writeVariable(var, BB, val);
+		return val;
+	}
+	Value *ptr = dispatch(loc);
+	Value *val = dispatch(node->getExpression());
+	int op = node->getAssignmentOperator();
 	Value *v;
 	if(val->getType()->isPointerTy())
-		val = Builder->CreateLoad(val, "tmp");
-	switch(op[0]) {
-		case '=':
-			return Builder->CreateStore(val, ptr, false);
-		case '+':
-			v = Builder->CreateLoad(ptr, "ptr");
-			val = Builder->CreateAdd(v, val, "ADD");
-			return Builder->CreateStore(val, ptr, false);
-		case '-':
-			v = Builder->CreateLoad(ptr, "ptr");
-			val = Builder->CreateSub(v, val, "ADD");
-			return Builder->CreateStore(val, ptr, false);
+		val = builder_.CreateLoad(val, "tmp");
+	switch(op) {
+		case _assign:
+			return builder_.CreateStore(val, ptr, false);
+		case _plusassign:
+			v = builder_.CreateLoad(ptr, "ptr");
+			val = builder_.CreateAdd(v, val, "ADD");
+			return builder_.CreateStore(val, ptr, false);
+		case _minusassign:
+			v = builder_.CreateLoad(ptr, "ptr");
+			val = builder_.CreateSub(v, val, "ADD");
+			return builder_.CreateStore(val, ptr, false);
 	}
 }
 
 Value *EvaluateVisitor::visit(ASTIntegerLiteralExpressionNode *node) {
-	return Builder->getInt32(node->getValue());
+	return builder_.getInt32(node->getValue());
+}
+Value *EvaluateVisitor::visit(ASTCharLiteralExpressionNode *node) {
+	return builder_.getInt32(node->getValue());
 }
 Value *EvaluateVisitor::visit(ASTBoolLiteralExpressionNode *node) {
-	string val = node->getValue();
-	int v = 0;
-	if(!(val.compare("true"))) {
-		v = 1;
-	}
-	return Builder->getInt1(v);
+	return builder_.getInt1(node->getValue());
 }
 
 Value *EvaluateVisitor::visit(ASTLocationExpressionNode *node) {
 	ASTLocationNode *loc = node->getLocation();
-	Value *v = loc->accept(this);
+	Value *v = dispatch(loc);
 	return v;
 }
 
@@ -110,64 +331,162 @@ Value *EvaluateVisitor::visit(ASTLocationExpressionNode *node) {
  * Unary and Binary expressions are handled here.
  */
 Value *EvaluateVisitor::visit(ASTUnaryExpressionNode *node) {
-	Value *R = node->right->accept(this);
+	Value *R = dispatch(node->right);
 	if(!R) {
 		return nullptr;
 	}
 	if(R->getType()->isPointerTy()) {
-		R = Builder->CreateLoad(R, "tmp");
+		R = builder_.CreateLoad(R, "tmp");
 	}
 	int op = node->getOperatorId();
 	switch(op) {
 		case _unaryminus:
-			return Builder->CreateNeg(R, "NEG");
+			return builder_.CreateNeg(R, "NEG");
 		case _negate:
-			return Builder->CreateNot(R, "NOT");
+			return builder_.CreateNot(R, "NOT");
 		default:
 			return ErrorV("Invalid Unary operator");
 	}
 }
 
+/*
+ * Loads the value of a location, and turns an int used as a condition into
+ * a boolean the way Decaf always has : it is true when it equals 1.
+ * Booleans, comparisons included, are used as they are.
+ */
+Value *EvaluateVisitor::toCondition(Value *v) {
+	if(v->getType()->isPointerTy()) {
+		v = builder_.CreateLoad(v, "tmp");
+	}
+	if(v->getType()->isIntegerTy(32)) {
+		v = builder_.CreateICmpEQ(v, builder_.getInt32(1), "cmp");
+	}
+	return v;
+}
+
+/*
+ * Branches on a condition in control flow form, without computing its
+ * value when it is not needed. The right side of && and || is only
+ * evaluated when the left one does not decide, ! swaps the targets, and a
+ * comparison feeds the branch directly.
+ */
+void EvaluateVisitor::emitBranch(ASTExpressionNode *cond, BasicBlock *trueBB, BasicBlock *falseBB) {
+	Function *F = builder_.GetInsertBlock()->getParent();
+	if(cond->getKind() == AST_BINARY_EXPRESSION) {
+		ASTBinaryExpressionNode *node = static_cast<ASTBinaryExpressionNode *>(cond);
+		int op = node->getOperatorId();
+		if(op == _and || op == _or) {
+			BasicBlock *RHS = BasicBlock::Create(context_, op == _and ? "and.rhs" : "or.rhs", F);
+			if(op == _and) {
+				emitBranch(node->left, RHS, falseBB);
+			}
+			else {
+				emitBranch(node->left, trueBB, RHS);
+			}
+			startBlock(RHS);
+			emitBranch(node->right, trueBB, falseBB);
+			return;
+		}
+	}
+	if(cond->getKind() == AST_UNARY_EXPRESSION) {
+		ASTUnaryExpressionNode *node = static_cast<ASTUnaryExpressionNode *>(cond);
+		if(node->getOperatorId() == _negate) {
+			emitBranch(node->right, falseBB, trueBB);
+			return;
+		}
+	}
+	if(cond->getKind() == AST_BOOL_LITERAL) {
+		builder_.CreateBr(static_cast<ASTBoolLiteralExpressionNode *>(cond)->getValue() ? trueBB : falseBB);
+		return;
+	}
+	Value *v = dispatch(cond);
+	if(v) {
+		builder_.CreateCondBr(toCondition(v), trueBB, falseBB);
+	}
+}
+
+/*
+ * Value of && or || where a boolean is needed (an assignment, an argument).
+ * The operands are branched on as in a condition, and the result is a phi
+ * of the constant the skipped paths decide and of the right operand.
+ */
+Value *EvaluateVisitor::emitLogical(ASTBinaryExpressionNode *node) {
+	bool isAnd = node->getOperatorId() == _and;
+	Function *F = builder_.GetInsertBlock()->getParent();
+	BasicBlock *RHS = BasicBlock::Create(context_, isAnd ? "and.rhs" : "or.rhs", F);
+	BasicBlock *End = BasicBlock::Create(context_, isAnd ? "and.end" : "or.end", F);
+	if(isAnd) {
+		emitBranch(node->left, RHS, End);
+	}
+	else {
+		emitBranch(node->left, End, RHS);
+	}
+
+	startBlock(RHS);
+	Value *R = dispatch(node->right);
+	if(!R) {
+		return nullptr;
+	}
+	R = toCondition(R);
+	BasicBlock *RHSEnd = builder_.GetInsertBlock();
+	builder_.CreateBr(End);
+
+	startBlock(End);
+	PHINode *phi = builder_.CreatePHI(builder_.getInt1Ty(), 2, isAnd ? "AND" : "OR");
+	for(pred_iterator it = pred_begin(End); it != pred_end(End); it++) {
+		BasicBlock *pred = *it;
+		phi->addIncoming(pred == RHSEnd ? R : builder_.getInt1(!isAnd), pred);
+	}
+	return phi;
+}
+
 Value *EvaluateVisitor::visit(ASTBinaryExpressionNode *node) {
-	Value *L = node->left->accept(this);
-	Value *R = node->right->accept(this);
+	int op = node->getOperatorId();
+	if(op == _and || op == _or) {
+		return emitLogical(node);
+	}
+	Value *L = dispatch(node->left);
+	Value *R = dispatch(node->right);
 	if (!L || !R) {
 		return nullptr;
 	}
 	if(L->getType()->isPointerTy()) {
-		L = Builder->CreateLoad(L, "tmp");
+		L = builder_.CreateLoad(L, "tmp");
 	}
 	if(R->getType()->isPointerTy()) {
-		R = Builder->CreateLoad(R, "tmp");
+		R = builder_.CreateLoad(R, "tmp");
 	}
-	int op = node->getOperatorId();
 	switch(op) {
 		case _plus:
-			return Builder->CreateAdd(L, R, "ADD");
+			return builder_.CreateAdd(L, R, "ADD");
 		case _minus:
-			return Builder->CreateSub(L, R, "SUB");
+			return builder_.CreateSub(L, R, "SUB");
 		case _mult:
-			return Builder->CreateMul(L, R, "MUL");
+			return builder_.CreateMul(L, R, "MUL");
 		case _div:
-			return Builder->CreateUDiv(L, R, "DIV");
+			return builder_.CreateSDiv(L, R, "DIV");
 		case _mod:
-			return Builder->CreateURem(L, R, "MOD");
-		case _and:
-			return Builder->CreateAnd(L, R, "AND");
-		case _or:
-			return Builder->CreateOr(L, R, "OR");
+			return builder_.CreateSRem(L, R, "MOD");
+		case _shl:
+			return builder_.CreateShl(L, R, "SHL");
+		case _ashr:
+			return builder_.CreateAShr(L, R, "ASHR");
+		case _lshr:
+			return builder_.CreateLShr(L, R, "LSHR");
+		case _bitand:
+			return builder_.CreateAnd(L, R, "BITAND");
 		case _eq:
-			return Builder->CreateICmpEQ(L, R, "EQ");
+			return builder_.CreateICmpEQ(L, R, "EQ");
 		case _neq:
-			return Builder->CreateICmpNE(L, R, "NEQ");
+			return builder_.CreateICmpNE(L, R, "NEQ");
 		case _lt:
-			return Builder->CreateICmpSLT(L, R, "LT");
+			return builder_.CreateICmpSLT(L, R, "LT");
 		case _gt:
-			return Builder->CreateICmpSGT(L, R, "GT");
+			return builder_.CreateICmpSGT(L, R, "GT");
 		case _lteq:
-			return Builder->CreateICmpSLE(L, R, "LTEQ");
+			return builder_.CreateICmpSLE(L, R, "LTEQ");
 		case _gteq:
-			return Builder->CreateICmpSGE(L, R, "GTEQ");
+			return builder_.CreateICmpSGE(L, R, "GTEQ");
 		default:
 			return ErrorV("Invalid Binary Operator");
 	}
@@ -177,12 +496,12 @@ Value *EvaluateVisitor::visit(ASTBinaryExpressionNode *node) {
  * Function to get the LLVM Datatype from the decafType that we
  * give as input.
  */
-Type *getLLVMType(int decafTy) {
+static Type *getLLVMType(LLVMContext &C, int decafTy) {
 	switch(decafTy) {
 		case _int_:
-			return Builder->getInt32Ty();
+			return Type::getInt32Ty(C);
 		case _bool_:
-			return Builder->getInt1Ty();
+			return Type::getInt1Ty(C);
 		default:
 			runtime_error("Unknown Datatype");
 	}
@@ -190,7 +509,14 @@ Type *getLLVMType(int decafTy) {
 
 Value *EvaluateVisitor::visit(ASTMethodCallExpressionNode *node) {
 	ASTMethodCallStatementNode *meth = node->getMethodCallStatement();
-	return meth->accept(this);
+	Value *v = dispatch(meth);
+	if(v->getType()->isVoidTy()) {
+		// Only simple method calls can be void; callouts return int
+		error(Session->getName(static_cast<ASTSimpleMethodCallNode *>(meth)->getMethodName()).str() +
+			  " does not return a value");
+		return UndefValue::get(builder_.getInt32Ty());
+	}
+	return v;
 }
 
 /*
@@ -202,86 +528,533 @@ Value *EvaluateVisitor::visit(ASTMethodCallExpressionNode *node) {
  * to prevent writing the following instructions.
  */
 Value *EvaluateVisitor::visit(ASTBreakStatementNode *node) {
-	loop *thisLoop = loops.top();
+	loop *thisLoop = loops_.top();
 	BasicBlock *BB = thisLoop->afterBB;
-	Builder->CreateBr(BB);
+	builder_.CreateBr(BB);
 	return nullptr;
 }
 
 /*
- * In continue statements, we get the present loop's entry and exit blocks.
- * We then write the loop's iterator increment and check condition instructions
- * in the present basic block and then return a nullptr so that any further
- * instructions in the present BB are not written in the bitcode.
+ * In continue statements, we branch to the latch of the present loop,
+ * which checks the condition and steps the iterator, and then return a
+ * nullptr so that any further instructions in the present BB are not
+ * written in the bitcode.
  */
 Value *EvaluateVisitor::visit(ASTContinueStatementNode *node) {
-	loop* thisLoop = loops.top();
-	BasicBlock *inBB = thisLoop->entryBB;
-	BasicBlock *outBB = thisLoop->afterBB;
-	BasicBlock *cond = Builder->GetInsertBlock();
-	PHINode *v = thisLoop->var_;
-	Value *out = Builder->CreateAdd(v, Builder->getInt32(1), "ADD");
-	ASTExpressionNode *end = thisLoop->endExp;
-	Value *check = end->accept(this);
-	check = Builder->CreateICmpEQ(check, Builder->getInt1(1), "loopcond");
-	Builder->CreateCondBr(check, inBB, outBB);
-
-	v->addIncoming(out, cond);
+	loop *thisLoop = loops_.top();
+	builder_.CreateBr(thisLoop->latchBB);
 	return nullptr;
 }
 
 /*
- * For loop. We have two sections for any for loop. The Loop Basic
- * Block and the Basic Block after the loop. We write the PHINode for
- * the loop variable and then check for loop body to see how many inputs
- * are there to put in the PHINode. After this is done, we set the
- * instructions insert point as the after loop Basic Block.
+ * What the body of a loop may change : the variables and arrays it
+ * assigns, and whether it calls methods (which may assign any field).
+ * Also whether it leaves the loop other than through the condition, and
+ * whether it has loops of its own. The names the body uses are split into
+ * the scalars it updates with += or -=, and every other use.
+ *
+ * Names assigned in the body of a parallel loop inside the scanned code,
+ * other than the locals of that body, are shared between threads : they
+ * must live in memory, where every iteration reaches them.
+ */
+class LoopBodyScan : public ASTVisitorBase<LoopBodyScan, void> {
+	public:
+		LoopBodyScan() : calls_(false), callouts_(false), exits_(false), loops_(false),
+						 parallel_(0), parallelBase_(0) {}
+
+		set<Ident> assigned_;
+		set<Ident> accumulated_;
+		set<Ident> used_;
+		set<Ident> shared_;
+		bool calls_;
+		bool callouts_;
+		bool exits_;
+		bool loops_;
+
+		void visit(ASTProgramNode *node) {}
+		void visit(ASTMethodDeclNode *node) {}
+		void visit(ASTBlock *node) {
+			unsigned mark = declared_.size();
+			if(parallel_) {
+				const ASTArray<ASTFieldDecl *> &d = node->getFieldDeclList();
+				for(ASTArray<ASTFieldDecl *>::iterator it = d.begin(); it != d.end(); it++) {
+					const ASTArray<Symbol *> &vars = (*it)->getVariableList();
+					for(ASTArray<Symbol *>::iterator v = vars.begin(); v != vars.end(); v++) {
+						declared_.push_back((*v)->id_);
+					}
+				}
+			}
+			const ASTArray<ASTStatementDeclNode *> &s = node->getStatementList();
+			for(ASTArray<ASTStatementDeclNode *>::iterator it = s.begin(); it != s.end(); it++) {
+				dispatch(*it);
+			}
+			declared_.resize(mark);
+		}
+		void visit(ASTBlockStatementNode *node) {
+			dispatch(node->getBlock());
+		}
+		void visit(ASTAssignmentStatementNode *node) {
+			ASTLocationNode *loc = node->getLocation();
+			if(loc->getKind() == AST_VAR_LOCATION) {
+				Ident id = static_cast<ASTVarLocationNode *>(loc)->getVar();
+				assigned_.insert(id);
+				if(parallel_ && find(declared_.begin() + parallelBase_, declared_.end(), id) == declared_.end()) {
+					shared_.insert(id);
+				}
+				if(node->getAssignmentOperator() != _assign) {
+					accumulated_.insert(id);
+				}
+				else {
+					used_.insert(id);
+				}
+			}
+			else {
+				assigned_.insert(static_cast<ASTArrayLocationNode *>(loc)->getVar());
+				dispatch(loc);
+			}
+			dispatch(node->getExpression());
+		}
+		void visit(ASTSimpleMethodCallNode *node) {
+			const ASTArray<ASTExpressionNode *> &e = node->getExpressionList();
+			const Builtin *b = findBuiltin(Session->getName(node->getMethodName()));
+			if(!b) {
+				calls_ = true;
+			}
+			else {
+				// Like a callout, a builtin cannot reach the fields, but it may assign its array
+				callouts_ = true;
+				if(b->writes) {
+					ASTLocationNode *loc = static_cast<ASTLocationExpressionNode *>(e.front())->getLocation();
+					assigned_.insert(static_cast<ASTVarLocationNode *>(loc)->getVar());
+				}
+			}
+			for(ASTArray<ASTExpressionNode *>::iterator it = e.begin(); it != e.end(); it++) {
+				dispatch(*it);
+			}
+		}
+		void visit(ASTCalloutMethodCallNode *node) {
+			callouts_ = true;
+			const ASTArray<ASTCalloutArg *> &a = node->getArgumentList();
+			for(ASTArray<ASTCalloutArg *>::iterator it = a.begin(); it != a.end(); it++) {
+				dispatch(*it);
+			}
+		}
+		void visit(ASTIfStatementDeclNode *node) {
+			dispatch(node->getIfExpression());
+			dispatch(node->getIfBlock());
+			if(node->getElseBlock()) {
+				dispatch(node->getElseBlock());
+			}
+		}
+		void visit(ASTForStatementDeclNode *node) {
+			// A break or return in an inner loop leaves the inner loop only
+			bool exits = exits_;
+			unsigned base = parallelBase_;
+			loops_ = true;
+			dispatch(node->getInitExpression());
+			dispatch(node->getFinalExpression());
+			if(node->isParallel()) {
+				parallel_++;
+				parallelBase_ = declared_.size();
+			}
+			dispatch(node->getForBody());
+			if(node->isParallel()) {
+				parallel_--;
+				parallelBase_ = base;
+			}
+			exits_ = exits;
+		}
+		void visit(ASTReturnStatementNode *node) {
+			exits_ = true;
+			if(node->getReturnExpression()) {
+				dispatch(node->getReturnExpression());
+			}
+		}
+		void visit(ASTBreakStatementNode *node) {
+			exits_ = true;
+		}
+		void visit(ASTContinueStatementNode *node) {}
+		void visit(ASTVarLocationNode *node) {
+			used_.insert(node->getVar());
+		}
+		void visit(ASTArrayLocationNode *node) {
+			used_.insert(node->getVar());
+			dispatch(node->getExpression());
+		}
+		void visit(ASTExpressionCalloutArg *node) {
+			dispatch(node->getExpression());
+		}
+		void visit(ASTStringCalloutArg *node) {}
+		void visit(ASTMethodCallExpressionNode *node) {
+			dispatch(node->getMethodCallStatement());
+		}
+		void visit(ASTIntegerLiteralExpressionNode *node) {}
+		void visit(ASTBoolLiteralExpressionNode *node) {}
+		void visit(ASTCharLiteralExpressionNode *node) {}
+		void visit(ASTLocationExpressionNode *node) {
+			dispatch(node->getLocation());
+		}
+		void visit(ASTBinaryExpressionNode *node) {
+			dispatch(node->left);
+			dispatch(node->right);
+		}
+		void visit(ASTUnaryExpressionNode *node) {
+			dispatch(node->right);
+		}
+
+	private:
+		int parallel_;					// Parallel loops around the code being scanned
+		vector<Ident> declared_;		// Locals declared in them, innermost last
+		unsigned parallelBase_;			// First local of the innermost parallel loop
+};
+
+/*
+ * Whether an expression has the same value on every iteration of a loop
+ * with the given iterator and body, so that it can be computed once before
+ * the loop. Only scalars, literals and arithmetic that cannot trap qualify.
+ */
+bool EvaluateVisitor::isLoopInvariant(ASTExpressionNode *e, Ident it, const LoopBodyScan &scan) {
+	switch(e->getKind()) {
+		case AST_INTEGER_LITERAL:
+		case AST_CHAR_LITERAL:
+		case AST_BOOL_LITERAL:
+			return true;
+		case AST_LOCATION_EXPRESSION: {
+			ASTLocationNode *loc = static_cast<ASTLocationExpressionNode *>(e)->getLocation();
+			if(loc->getKind() != AST_VAR_LOCATION) {
+				return false;
+			}
+			Ident id = static_cast<ASTVarLocationNode *>(loc)->getVar();
+			if(id == it || scan.assigned_.count(id)) {
+				return false;
+			}
+			if(symTable_.lookupVariable(id) >= 0) {
+				return true;			// A local, which calls cannot change
+			}
+			Value *v = symTable_.lookup(id);
+			return v && (!isa<GlobalVariable>(v) || !scan.calls_);
+		}
+		case AST_BINARY_EXPRESSION: {
+			int op = static_cast<ASTBinaryExpressionNode *>(e)->getOperatorId();
+			return op != _div && op != _mod && op != _and && op != _or &&
+				   isLoopInvariant(e->left, it, scan) && isLoopInvariant(e->right, it, scan);
+		}
+		case AST_UNARY_EXPRESSION:
+			return isLoopInvariant(e->right, it, scan);
+		default:
+			return false;
+	}
+}
+
+/* Predicate of a comparison operator, or BAD_ICMP_PREDICATE */
+static CmpInst::Predicate comparison(int op) {
+	switch(op) {
+		case _lt:
+			return CmpInst::ICMP_SLT;
+		case _lteq:
+			return CmpInst::ICMP_SLE;
+		case _gt:
+			return CmpInst::ICMP_SGT;
+		case _gteq:
+			return CmpInst::ICMP_SGE;
+		case _eq:
+			return CmpInst::ICMP_EQ;
+		case _neq:
+			return CmpInst::ICMP_NE;
+	}
+	return CmpInst::BAD_ICMP_PREDICATE;
+}
+
+static bool isVariable(ASTExpressionNode *e, Ident id) {
+	if(e->getKind() != AST_LOCATION_EXPRESSION) {
+		return false;
+	}
+	ASTLocationNode *loc = static_cast<ASTLocationExpressionNode *>(e)->getLocation();
+	return loc->getKind() == AST_VAR_LOCATION && static_cast<ASTVarLocationNode *>(loc)->getVar() == id;
+}
+
+/* One "llvm.loop" hint : a name and, if not negative, an i1 or i32 value */
+static MDNode *loopHint(LLVMContext &C, const char *name, int value, bool isBool) {
+	SmallVector<Metadata *, 2> ops;
+	ops.push_back(MDString::get(C, name));
+	if(value >= 0) {
+		Type *Ty = isBool ? Type::getInt1Ty(C) : Type::getInt32Ty(C);
+		ops.push_back(ConstantAsMetadata::get(ConstantInt::get(Ty, value)));
+	}
+	return MDNode::get(C, ops);
+}
+
+/*
+ * The "llvm.loop" node of a loop, which refers to itself so that every
+ * loop gets a node of its own. An innermost loop with a trip count known
+ * on entry, and no calls or early exits, can be vectorized, and is asked
+ * to be even where the vectorizer would only consider loops on request
+ * (-O1). A body that makes calls is not worth unrolling : the calls
+ * dominate it, and every copy is code for nothing.
+ */
+static MDNode *loopMetadata(LLVMContext &C, const LoopBodyScan &scan, bool countable) {
+	SmallVector<Metadata *, 4> ops;
+	MDNode *Temp = MDNode::getTemporary(C, None);
+	ops.push_back(Temp);
+	if(countable && !scan.calls_ && !scan.callouts_ && !scan.exits_ && !scan.loops_) {
+		ops.push_back(loopHint(C, "llvm.loop.vectorize.enable", 1, true));
+	}
+	if(scan.calls_ || scan.callouts_) {
+		ops.push_back(loopHint(C, "llvm.loop.unroll.disable", -1, false));
+	}
+	MDNode *LoopID = MDNode::get(C, ops);
+	LoopID->replaceOperandWith(0, LoopID);
+	MDNode::deleteTemporary(Temp);
+	return LoopID;
+}
+
+/*
+ * For loop. The body runs first, for the initial value of the iterator,
+ * and then again with the iterator stepped for as long as the condition,
+ * tested on the iterator before the step, holds.
+ *
+ * When the condition compares the iterator with a loop invariant bound,
+ * the bound is computed once, before the loop. The bound of a parallel
+ * loop is computed once whatever the body does.
  */
 Value *EvaluateVisitor::visit(ASTForStatementDeclNode *node) {
-	ASTExpressionNode *start = node->getInitExpression();
 	ASTExpressionNode *end = node->getFinalExpression();
-	string it = node->getIterVarName();
-	ASTBlock *body = node->getForBody();
+	Ident it = node->getIterVarName();
+
+	Value *init = dispatch(node->getInitExpression());
+	if(init->getType()->isPointerTy()) {
+		init = builder_.CreateLoad(init, "tmp");
+	}
 
-	Value *init = start->accept(this);
-	Function *F = Builder->GetInsertBlock()->getParent();
+	LoopBodyScan scan;
+	scan.dispatch(node->getForBody());
 
-	BasicBlock *LoopBB = BasicBlock::Create(getGlobalContext(), "loop", F);
-	BasicBlock *AfterBB = BasicBlock::Create(getGlobalContext(), "afterloop", F);
+	// i op bound, or bound op i
+	CmpInst::Predicate pred = CmpInst::BAD_ICMP_PREDICATE;
+	ASTExpressionNode *boundExp = nullptr;
+	if(end->getKind() == AST_BINARY_EXPRESSION) {
+		pred = comparison(static_cast<ASTBinaryExpressionNode *>(end)->getOperatorId());
+		if(pred != CmpInst::BAD_ICMP_PREDICATE && isVariable(end->left, it)) {
+			boundExp = end->right;
+		}
+		else if(pred != CmpInst::BAD_ICMP_PREDICATE && isVariable(end->right, it)) {
+			boundExp = end->left;
+			pred = CmpInst::getSwappedPredicate(pred);
+		}
+	}
+	bool parallel = node->isParallel() && boundExp && (pred == CmpInst::ICMP_SLT || pred == CmpInst::ICMP_SLE);
 
-	BasicBlock *PreHeaderBB = Builder->GetInsertBlock();
-	Builder->CreateBr(LoopBB);
+	Value *bound = nullptr;
+	if(boundExp && (parallel || isLoopInvariant(boundExp, it, scan))) {
+		bound = dispatch(boundExp);
+		if(bound->getType()->isPointerTy()) {
+			bound = builder_.CreateLoad(bound, "bound");
+		}
+	}
+	if(parallel) {
+		emitParallelFor(node, init, pred, bound, scan);
+	}
+	else {
+		emitLoop(node, init, pred, bound, scan);
+	}
+	return builder_.getInt32(0);
+}
 
-	Builder->SetInsertPoint(LoopBB);
-	PHINode *var = Builder->CreatePHI(Type::getInt32Ty(getGlobalContext()), 2, it.c_str());
+/*
+ * The loop itself is rotated, with no guard : the block before the loop
+ * is its preheader, the body starts with the iterator phi, and every path
+ * back (the end of the body and continue statements) goes through a
+ * single latch, which tests the condition and steps the iterator.
+ *
+ * With a bound computed before the loop, the latch is a single compare
+ * and branch, from which the trip count is plain to see. Stepping an
+ * iterator that is less than its bound cannot overflow, so the step is
+ * then nsw. Otherwise the latch evaluates the condition of the loop.
+ */
+void EvaluateVisitor::emitLoop(ASTForStatementDeclNode *node, Value *init, CmpInst::Predicate pred,
+							   Value *bound, const LoopBodyScan &scan) {
+	Ident it = node->getIterVarName();
+	Function *F = builder_.GetInsertBlock()->getParent();
 
-	loop *thisLoop = (loop *)malloc(sizeof(loop));
-	thisLoop->entryBB = LoopBB;
-	thisLoop->afterBB = AfterBB;
-	thisLoop->var_ = var;
-	thisLoop->endExp = end;
-	loops.push(thisLoop);
+	BasicBlock *PreHeaderBB = builder_.GetInsertBlock();
+	BasicBlock *LoopBB = BasicBlock::Create(context_, "loop", F);
+	BasicBlock *LatchBB = BasicBlock::Create(context_, "for.latch");
+	BasicBlock *AfterBB = BasicBlock::Create(context_, "afterloop");
+	builder_.CreateBr(LoopBB);
 
+	builder_.SetInsertPoint(LoopBB);
+	PHINode *var = builder_.CreatePHI(Type::getInt32Ty(context_), 2, Session->getName(it));
 	var->addIncoming(init, PreHeaderBB);
 
-	symTable[it] = var;
+	loop thisLoop = { LatchBB, AfterBB };
+	loops_.push(&thisLoop);
+	symTable_.pushScope();
+	symTable_.insert(it, var);
+
+	if(dispatch(node->getForBody()) != nullptr) {
+		builder_.CreateBr(LatchBB);
+	}
+
+	// Only a body that never reaches the end and never continues has no latch
+	if(pred_begin(LatchBB) != pred_end(LatchBB)) {
+		F->getBasicBlockList().push_back(LatchBB);
+		startBlock(LatchBB);
+		BranchInst *backedge;
+		if(bound) {
+			Value *cond = builder_.CreateICmp(pred, var, bound, "loopcond");
+			Value *next = pred == CmpInst::ICMP_SLT ? builder_.CreateNSWAdd(var, builder_.getInt32(1), "ADD")
+													: builder_.CreateAdd(var, builder_.getInt32(1), "ADD");
+			backedge = builder_.CreateCondBr(cond, LoopBB, AfterBB);
+			var->addIncoming(next, LatchBB);
+		}
+		else {
+			BasicBlock *NextBB = BasicBlock::Create(context_, "for.inc");
+			emitBranch(node->getFinalExpression(), NextBB, AfterBB);
+			F->getBasicBlockList().push_back(NextBB);
+			startBlock(NextBB);
+			Value *next = builder_.CreateAdd(var, builder_.getInt32(1), "ADD");
+			backedge = builder_.CreateBr(LoopBB);
+			var->addIncoming(next, NextBB);
+		}
+		backedge->setMetadata("llvm.loop", loopMetadata(context_, scan, bound != nullptr));
+	}
+	else {
+		delete LatchBB;
+	}
+	sealBlock(LoopBB);
+	F->getBasicBlockList().push_back(AfterBB);
+	startBlock(AfterBB);
+	symTable_.popScope();
+	loops_.pop();
+}
+
+static AllocaInst *CreateEntryBlockAlloca(Function *TheFunction, Type *ty, StringRef VarName);
+
+static bool byName(Ident a, Ident b) {
+	return Session->getName(a) < Session->getName(b);
+}
+
+/*
+ * Parallel for loop. The iterations are those of the sequential loop :
+ * from the initial value up to the bound (one further for <=), and at
+ * least one. The body is outlined into an internal function running the
+ * iterations [lo, hi] in order, and the runtime (__decaf_parallel_for)
+ * calls it on chunks of the range from the threads of its pool, returning
+ * once all of them are done.
+ *
+ * The outlined function gets the locals the body names through a context
+ * record : the address of the variables kept in memory (those that some
+ * parallel loop assigns, see LoopBodyScan), and the value of the others,
+ * which the body only reads. Fields are used directly. A scalar that the body only
+ * updates with += or -= is a reduction : every call accumulates into a
+ * zeroed copy of its own, and adds that to the variable atomically once
+ * its iterations are done.
+ */
+void EvaluateVisitor::emitParallelFor(ASTForStatementDeclNode *node, Value *init, CmpInst::Predicate pred,
+									  Value *bound, const LoopBodyScan &scan) {
+	Ident it = node->getIterVarName();
+	Function *F = builder_.GetInsertBlock()->getParent();
 
-	Value *bodyVal = body->accept(this);
-	if(bodyVal != nullptr) {
-		Value *NextVar = Builder->CreateAdd(var, Builder->getInt32(1), "ADD");
+	Value *last = bound;
+	if(pred == CmpInst::ICMP_SLE) {
+		last = builder_.CreateAdd(bound, builder_.getInt32(1), "ADD");
+	}
+	last = builder_.CreateSelect(builder_.CreateICmpSGT(init, last, "cmptmp"), init, last, "last");
 
-		Value *endVal = end->accept(this);
-		endVal = Builder->CreateICmpEQ(endVal, Builder->getInt1(1), "loopcond");
-		BasicBlock *LoopEndBB = Builder->GetInsertBlock();
+	// Ordered by name, so that the IR does not depend on the numbering of identifiers
+	set<Ident> named(scan.used_);
+	named.insert(scan.accumulated_.begin(), scan.accumulated_.end());
+	vector<Ident> captured, reductions;
+	for(set<Ident>::iterator i = named.begin(); i != named.end(); i++) {
+		Value *v = symTable_.lookup(*i);
+		if(*i == it || (!v && symTable_.lookupVariable(*i) < 0)) {
+			continue;
+		}
+		if(!v || !isa<GlobalValue>(v)) {
+			captured.push_back(*i);
+		}
+		if(v && scan.accumulated_.count(*i) && !scan.used_.count(*i) && v->getType()->isPointerTy() &&
+		   cast<PointerType>(v->getType())->getElementType()->isIntegerTy(32)) {
+			reductions.push_back(*i);
+		}
+	}
+	std::sort(captured.begin(), captured.end(), byName);
+	std::sort(reductions.begin(), reductions.end(), byName);
 
-		Builder->CreateCondBr(endVal, LoopBB, AfterBB);
+	// The body does not assign the variables that are not in memory, so it gets their values
+	vector<Value *> values;
+	vector<Type *> fieldTypes;
+	for(unsigned i = 0; i < captured.size(); i++) {
+		int var = symTable_.lookupVariable(captured[i]);
+		values.push_back(var >= 0 ? readVariable(var, builder_.GetInsertBlock()) : symTable_.lookup(captured[i]));
+		fieldTypes.push_back(values[i]->getType());
+	}
+	StructType *CtxTy = StructType::get(context_, fieldTypes);
+	Type *bodyArgs[] = { builder_.getInt8PtrTy(), builder_.getInt32Ty(), builder_.getInt32Ty() };
+	FunctionType *BodyTy = FunctionType::get(builder_.getVoidTy(), bodyArgs, false);
+	Function *Body = Function::Create(BodyTy, Function::InternalLinkage, F->getName() + ".par", module_);
 
-		var->addIncoming(NextVar, LoopEndBB);
+	Value *ctx = Constant::getNullValue(builder_.getInt8PtrTy());
+	if(!captured.empty()) {
+		AllocaInst *record = CreateEntryBlockAlloca(F, CtxTy, "ctx");
+		for(unsigned i = 0; i < captured.size(); i++) {
+			builder_.CreateStore(values[i], builder_.CreateStructGEP(record, i, "ctx.field"));
+		}
+		ctx = builder_.CreateBitCast(record, builder_.getInt8PtrTy(), "ctx");
 	}
-	Builder->SetInsertPoint(AfterBB);
-	loops.pop();
+	Type *runArgs[] = { PointerType::getUnqual(BodyTy), builder_.getInt8PtrTy(), builder_.getInt32Ty(), builder_.getInt32Ty() };
+	FunctionType *RunTy = FunctionType::get(builder_.getVoidTy(), runArgs, false);
+	Constant *runFunc = getFunction("__decaf_parallel_for", RunTy);
+	Value *runArgsV[] = { Body, ctx, init, last };
+	builder_.CreateCall(runFunc, runArgsV);
 
-	return Builder->getInt32(0);
+	// The outlined body, generated with the scopes of the loop
+	IRBuilderBase::InsertPoint ip = builder_.saveIP();
+	Function::arg_iterator args = Body->arg_begin();
+	Value *ctxArg = args++;
+	Value *lo = args++;
+	Value *hi = args++;
+	ctxArg->setName("ctx");
+	lo->setName("lo");
+	hi->setName("hi");
+	startBlock(BasicBlock::Create(context_, "entry", Body));
+	symTable_.pushScope();
+	if(!captured.empty()) {
+		Value *record = builder_.CreateBitCast(ctxArg, PointerType::getUnqual(CtxTy), "ctx");
+		for(unsigned i = 0; i < captured.size(); i++) {
+			Value *field = builder_.CreateStructGEP(record, i, "ctx.field");
+			symTable_.insert(captured[i], builder_.CreateLoad(field, Session->getName(captured[i])));
+		}
+	}
+	// The copy is in memory only if a parallel loop in the body adds to it too
+	vector<Value *> shared;
+	for(unsigned i = 0; i < reductions.size(); i++) {
+		StringRef name = Session->getName(reductions[i]);
+		shared.push_back(symTable_.lookup(reductions[i]));
+		if(scan.shared_.count(reductions[i])) {
+			symTable_.insert(reductions[i], defineVariable(builder_.getInt32Ty(), nullptr, name));
+		}
+		else {
+			unsigned var = newVariable(builder_.getInt32Ty(), name);
+			writeVariable(var, builder_.GetInsertBlock(), builder_.getInt32(0));
+			symTable_.insertVariable(reductions[i], var);
+		}
+	}
+	emitLoop(node, lo, CmpInst::ICMP_SLT, hi, scan);
+	for(unsigned i = 0; i < reductions.size(); i++) {
+		Value *partial = symTable_.lookup(reductions[i]);
+		int var = symTable_.lookupVariable(reductions[i]);
+		if(var >= 0) {
+			partial = readVariable(var, builder_.GetInsertBlock());
+		}
+		else {
+			partial = builder_.CreateLoad(partial, "partial");
+		}
+		builder_.CreateAtomicRMW(AtomicRMWInst::Add, shared[i], partial, Monotonic);
+	}
+	builder_.CreateRetVoid();
+	symTable_.popScope();
+	builder_.restoreIP(ip);
 }
 
 /*
@@ -296,137 +1069,452 @@ Value *EvaluateVisitor::visit(ASTIfStatementDeclNode *node) {
 	ASTExpressionNode *ifExp = node->getIfExpression();
 	ASTBlock *ifBlock = node->getIfBlock();
 	ASTBlock *elseBlock = node->getElseBlock();
-	Value *v = ifExp->accept(this);
-	Value *ifVal = Builder->getInt32(1);
-	Value *elseVal = Builder->getInt32(1);
-	if(!v) {
-		return nullptr;
-	}
-	if(v->getType()->isIntegerTy()) {
-		if(v->getType()->isIntegerTy(32)) {
-			v = Builder->CreateICmpEQ(v, Builder->getInt32(1), "cmp");
-		}
-		else {
-			v = Builder->CreateICmpEQ(v, Builder->getInt1(1), "cmp");
-		}
-		Function *F = Builder->GetInsertBlock()->getParent();
-		BasicBlock *ThenBB = BasicBlock::Create(getGlobalContext(), "then", F);
-		if(elseBlock) {
-			 BasicBlock *ElseBB = BasicBlock::Create(getGlobalContext(), "else");
-			 BasicBlock *MergeBB = BasicBlock::Create(getGlobalContext(), "ifcont");
-			 Builder->CreateCondBr(v, ThenBB, ElseBB);
-			 Builder->SetInsertPoint(ThenBB);
-
-	 		ifVal = ifBlock->accept(this);
-	 		if(ifVal) {
-	 			Builder->CreateBr(MergeBB);
-	 		}
-	 		ThenBB = Builder->GetInsertBlock();
+	Value *ifVal = builder_.getInt32(1);
+	Value *elseVal = builder_.getInt32(1);
+	Function *F = builder_.GetInsertBlock()->getParent();
+	BasicBlock *ThenBB = BasicBlock::Create(context_, "then", F);
+	BasicBlock *MergeBB = BasicBlock::Create(context_, "ifcont");
+	if(elseBlock) {
+		BasicBlock *ElseBB = BasicBlock::Create(context_, "else");
+		emitBranch(ifExp, ThenBB, ElseBB);
+		startBlock(ThenBB);
 
-			F->getBasicBlockList().push_back(ElseBB);
-			Builder->SetInsertPoint(ElseBB);
+		ifVal = dispatch(ifBlock);
+		if(ifVal) {
+			builder_.CreateBr(MergeBB);
+		}
 
-			elseVal = elseBlock->accept(this);
-			if(elseVal) {
-				Builder->CreateBr(MergeBB);
-			}
-			ElseBB = Builder->GetInsertBlock();
+		F->getBasicBlockList().push_back(ElseBB);
+		startBlock(ElseBB);
 
-			if(!ifVal && !elseVal) {
-				return Builder->getInt32(0);
-			}
-			else {
-				F->getBasicBlockList().push_back(MergeBB);
-				Builder->SetInsertPoint(MergeBB);
-				return Builder->getInt32(0);
-			}
+		elseVal = dispatch(elseBlock);
+		if(elseVal) {
+			builder_.CreateBr(MergeBB);
 		}
-		else {
-			BasicBlock *MergeBB = BasicBlock::Create(getGlobalContext(), "ifcont");
-			Builder->CreateCondBr(v, ThenBB, MergeBB);
-			Builder->SetInsertPoint(ThenBB);
-
-			ifVal = ifBlock->accept(this);
-			if(ifVal) {
-				Builder->CreateBr(MergeBB);
-			}
-			ThenBB = Builder->GetInsertBlock();
 
-			F->getBasicBlockList().push_back(MergeBB);
-			Builder->SetInsertPoint(MergeBB);
+		if(!ifVal && !elseVal) {
+			delete MergeBB;
+			return builder_.getInt32(0);
+		}
+	}
+	else {
+		emitBranch(ifExp, ThenBB, MergeBB);
+		startBlock(ThenBB);
 
-			return Builder->getInt32(0);
+		ifVal = dispatch(ifBlock);
+		if(ifVal) {
+			builder_.CreateBr(MergeBB);
 		}
 	}
+	F->getBasicBlockList().push_back(MergeBB);
+	startBlock(MergeBB);
+	return builder_.getInt32(0);
+}
+
+/* The call to a method of the program that an expression is, or nullptr */
+static ASTSimpleMethodCallNode *methodCall(ASTExpressionNode *e) {
+	if(e->getKind() != AST_METHOD_CALL_EXPRESSION) {
+		return nullptr;
+	}
+	ASTMethodCallStatementNode *call = static_cast<ASTMethodCallExpressionNode *>(e)->getMethodCallStatement();
+	if(call->getKind() != AST_SIMPLE_METHOD_CALL) {
+		return nullptr;
+	}
+	ASTSimpleMethodCallNode *node = static_cast<ASTSimpleMethodCallNode *>(call);
+	return findBuiltin(Session->getName(node->getMethodName())) ? nullptr : node;
 }
 
 /*
  * Return Statements are also such control flow statements that
  * once encountered, there's no need to write the instructions in the
  * present Basic Block, hence returning a nullptr.
+ *
+ * Returning a call to the method itself jumps back to the start of the
+ * method instead, with the arguments as the new values of the parameters
+ * (see visit(ASTMethodDeclNode)), so the recursion runs in constant stack.
+ * A call to another method is a tail call : musttail, which the code
+ * generator must honour, when the callee has the caller's prototype, and
+ * a tail call it may honour otherwise.
  */
 Value *EvaluateVisitor::visit(ASTReturnStatementNode *node) {
 	ASTExpressionNode *expr = node->getReturnExpression();
-	Value *v = expr->accept(this);
+	ASTSimpleMethodCallNode *call = methodCall(expr);
+	Function *F = builder_.GetInsertBlock()->getParent();
+	if(call && recurseBB_ && methodTable_[call->getMethodName()] == F &&
+			call->getExpressionList().size() == params_.size()) {
+		const ASTArray<ASTExpressionNode *> &exprList = call->getExpressionList();
+		vector<Value *> args;
+		for(unsigned i = 0; i < exprList.size(); i++) {
+			Value *v = dispatch(exprList[i]);
+			if(v->getType()->isPointerTy()) {
+				v = builder_.CreateLoad(v, "tmp");
+			}
+			args.push_back(v);
+		}
+		BasicBlock *BB = builder_.GetInsertBlock();
+		for(unsigned i = 0; i < args.size(); i++) {
+			if(params_[i].second) {
+				builder_.CreateStore(args[i], params_[i].second);
+			}
+			else {
+				writeVariable(params_[i].first, BB, args[i]);
+			}
+		}
+		builder_.CreateBr(recurseBB_);
+		return nullptr;
+	}
+
+	Value *v = dispatch(expr);
 	if(v->getType()->isPointerTy()) {
-		v = Builder->CreateLoad(v, "tmp");
+		v = builder_.CreateLoad(v, "tmp");
+	}
+	if(CallInst *CI = call ? dyn_cast<CallInst>(v) : nullptr) {
+		bool sameType = CI->getCalledFunction()->getFunctionType() == F->getFunctionType();
+		CI->setTailCallKind(sameType ? CallInst::TCK_MustTail : CallInst::TCK_Tail);
+	}
+	builder_.CreateRet(v);
+	return nullptr;
+}
+
+static const Builtin builtins[] = {
+	{ "array_sum", BUILTIN_SUM, 1, 1, false },
+	{ "array_min", BUILTIN_MIN, 1, 1, false },
+	{ "array_max", BUILTIN_MAX, 1, 1, false },
+	{ "array_fill", BUILTIN_FILL, 1, 2, true },
+	{ "array_copy", BUILTIN_COPY, 2, 2, true },
+	{ "array_count", BUILTIN_COUNT, 1, 2, false },
+	{ "array_dot", BUILTIN_DOT, 2, 2, false },
+};
+
+const Builtin *findBuiltin(StringRef name) {
+	if(!name.startswith("array_")) {
+		return nullptr;
+	}
+	for(unsigned i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+		if(name == builtins[i].name) {
+			return &builtins[i];
+		}
 	}
-	Builder->CreateRet(v);
 	return nullptr;
 }
 
+/* Call to a kernel of the runtime library, which only reads memory if readOnly */
+Value *EvaluateVisitor::callKernel(StringRef name, Type *ret, ArrayRef<Value *> args, bool readOnly) {
+	vector<Type *> types;
+	for(unsigned i = 0; i < args.size(); i++) {
+		types.push_back(args[i]->getType());
+	}
+	Constant *F = getFunction(name, FunctionType::get(ret, types, false));
+	if(Function *Fn = dyn_cast<Function>(F)) {
+		Fn->setDoesNotThrow();
+		if(readOnly) {
+			Fn->setOnlyReadsMemory();
+		}
+	}
+	return builder_.CreateCall(F, args);
+}
+
+/*
+ * Array builtins. The arrays go to the kernels as a pointer to their first
+ * element and their length, known from their type. Boolean arrays, a byte
+ * per element, have kernels of their own, and their sum, min and max are
+ * counts of the trues or falses. Copies, and fills of boolean arrays, are
+ * memmove and memset, which LLVM expands in place when they are short.
+ */
+Value *EvaluateVisitor::emitBuiltin(ASTSimpleMethodCallNode *node, const Builtin *b) {
+	const ASTArray<ASTExpressionNode *> &exprList = node->getExpressionList();
+	Value *arrays[2];
+	Type *elemTypes[2];
+	uint64_t length = 0;
+	bool valid = true;
+	for(unsigned i = 0; i < b->arrays; i++) {
+		Value *v = dispatch(exprList[i]);
+		PointerType *PT = dyn_cast<PointerType>(v->getType());
+		ArrayType *AT = PT ? dyn_cast<ArrayType>(PT->getElementType()) : nullptr;
+		if(!AT) {
+			error("argument " + to_string(i + 1) + " of " + b->name + " must name an array");
+			// The scalar's type still tells whether the call is on booleans
+			elemTypes[i] = PT ? PT->getElementType() : v->getType();
+			valid = false;
+			continue;
+		}
+		elemTypes[i] = AT->getElementType();
+		arrays[i] = builder_.CreateConstInBoundsGEP2_32(v, 0, 0, "elems");
+		if(i == 0 || AT->getNumElements() < length) {
+			length = AT->getNumElements();
+		}
+	}
+	if(valid && b->arrays == 2 && elemTypes[0] != elemTypes[1]) {
+		error(string("the arrays of ") + b->name + " must have the same element type");
+		valid = false;
+	}
+	Value *value = nullptr;
+	if(b->args > b->arrays) {
+		value = dispatch(exprList[b->arrays]);
+		if(value->getType()->isPointerTy()) {
+			value = builder_.CreateLoad(value, "tmp");
+		}
+		if(valid && value->getType() != elemTypes[0]) {
+			error("argument " + to_string(b->arrays + 1) + " of " + b->name + " must have the element type of the array");
+			valid = false;
+		}
+	}
+
+	bool isBool = elemTypes[0]->isIntegerTy(1);
+	if(!valid) {
+		// Stands for the result, of the type it would have, until the module is dropped
+		bool isTest = isBool && (b->kind == BUILTIN_MIN || b->kind == BUILTIN_MAX);
+		return UndefValue::get(isTest ? builder_.getInt1Ty() : builder_.getInt32Ty());
+	}
+	Type *intTy = builder_.getInt32Ty();
+	Value *n = builder_.getInt32(length);
+	if(b->kind == BUILTIN_COPY) {
+		unsigned size = isBool ? 1 : 4;
+		return builder_.CreateMemMove(arrays[0], arrays[1], length * size, size);
+	}
+	if(b->kind == BUILTIN_FILL && isBool) {
+		return builder_.CreateMemSet(arrays[0], builder_.CreateZExt(value, builder_.getInt8Ty()), length, 1);
+	}
+	if(isBool) {
+		for(unsigned i = 0; i < b->arrays; i++) {
+			arrays[i] = builder_.CreateBitCast(arrays[i], builder_.getInt8PtrTy());
+		}
+	}
+	if(value) {
+		value = builder_.CreateZExt(value, intTy);
+	}
+
+	switch(b->kind) {
+		case BUILTIN_SUM: {
+			if(isBool) {
+				Value *args[] = { arrays[0], n, builder_.getInt32(1) };
+				return callKernel("__decaf_array_count_bool", intTy, args, true);
+			}
+			Value *args[] = { arrays[0], n };
+			return callKernel("__decaf_array_sum", intTy, args, true);
+		}
+		case BUILTIN_MIN:
+		case BUILTIN_MAX: {
+			bool isMin = b->kind == BUILTIN_MIN;
+			if(isBool) {
+				// All true when no element is false; any true when some element is
+				Value *args[] = { arrays[0], n, builder_.getInt32(isMin ? 0 : 1) };
+				Value *count = callKernel("__decaf_array_count_bool", intTy, args, true);
+				return isMin ? builder_.CreateICmpEQ(count, builder_.getInt32(0), "all")
+							 : builder_.CreateICmpNE(count, builder_.getInt32(0), "any");
+			}
+			Value *args[] = { arrays[0], n };
+			return callKernel(isMin ? "__decaf_array_min" : "__decaf_array_max", intTy, args, true);
+		}
+		case BUILTIN_FILL: {
+			Value *args[] = { arrays[0], n, value };
+			return callKernel("__decaf_array_fill", builder_.getVoidTy(), args, false);
+		}
+		case BUILTIN_COUNT: {
+			Value *args[] = { arrays[0], n, value };
+			return callKernel(isBool ? "__decaf_array_count_bool" : "__decaf_array_count", intTy, args, true);
+		}
+		default: {
+			Value *args[] = { arrays[0], arrays[1], n };
+			return callKernel(isBool ? "__decaf_array_dot_bool" : "__decaf_array_dot", intTy, args, true);
+		}
+	}
+}
+
 /*
  * Different method call statements. Simple Method Call statements
- * are just like calling a user-defined function in C. callout is
- * a special function Structure, used to call "printf" from C's
- * standard library.
+ * are just like calling a user-defined function in C, unless they
+ * call an array builtin. callout is a special function Structure,
+ * used to call "printf" from C's standard library.
  */
 Value *EvaluateVisitor::visit(ASTSimpleMethodCallNode *node) {
-	string methName = node->getMethodName();
-	list<ASTExpressionNode *> *exprList = node->getExpressionList();
-	list<ASTExpressionNode *>::iterator it;
+	const ASTArray<ASTExpressionNode *> &exprList = node->getExpressionList();
+	ASTArray<ASTExpressionNode *>::iterator it;
 	vector<Value *> args;
 
-	for(it = exprList->begin(); it != exprList->end(); it++) {
-		Value *v = (*it)->accept(this);
+	const Builtin *b = findBuiltin(Session->getName(node->getMethodName()));
+	if(b) {
+		return emitBuiltin(node, b);
+	}
+
+	for(it = exprList.begin(); it != exprList.end(); it++) {
+		Value *v = dispatch(*it);
 		if(v->getType()->isPointerTy())
-			v = Builder->CreateLoad(v, "tmp");
+			v = builder_.CreateLoad(v, "tmp");
 		args.push_back(v);
 	}
-	Function *callMe = DecafToLLVM->getFunction(methName);
-	return Builder->CreateCall(callMe, args, "calltmp");
+	Function *callMe = methodTable_[node->getMethodName()];
+	return builder_.CreateCall(callMe, args, "calltmp");
+}
+
+/* Contents of a string literal, with its quotes removed and \n unescaped */
+static string unquote(StringRef in) {
+	string out;
+	for(int i = 1; i < in.size() - 1; i++) {
+		if(in[i] == '\\' && in[i+1] == 'n') {
+			out.push_back('\n');
+			i++;
+		}
+		else {
+			out.push_back(in[i]);
+		}
+	}
+	return out;
+}
+
+/* Text of a printf format, or the %d or %c conversion of an argument */
+struct FormatPiece {
+	char conversion;				// 0 for text
+	string text;
+	ASTExpressionNode *arg;
+};
+
+/*
+ * Splits the format of a callout to printf into pieces, with %% and the
+ * %s of string literal arguments copied into the text around them. Fails
+ * on any other conversion (or flag, width...) and when the arguments do
+ * not match the conversions, leaving the call to printf as it is.
+ */
+static bool parseFormat(const ASTArray<ASTCalloutArg *> &args, vector<FormatPiece> &pieces) {
+	string fmt = unquote(static_cast<ASTStringCalloutArg *>(args.front())->getString());
+	ASTArray<ASTCalloutArg *>::iterator arg = args.begin() + 1;
+	FormatPiece text = { 0, "", nullptr };
+	for(unsigned i = 0; i < fmt.size(); i++) {
+		if(fmt[i] != '%') {
+			text.text.push_back(fmt[i]);
+			continue;
+		}
+		if(++i == fmt.size()) {
+			return false;
+		}
+		if(fmt[i] == '%') {
+			text.text.push_back('%');
+			continue;
+		}
+		if(arg == args.end() || (fmt[i] != 'd' && fmt[i] != 'c' && fmt[i] != 's')) {
+			return false;
+		}
+		if(fmt[i] == 's') {
+			if((*arg)->getKind() != AST_STRING_CALLOUT_ARG) {
+				return false;
+			}
+			text.text += unquote(static_cast<ASTStringCalloutArg *>(*arg++)->getString());
+			continue;
+		}
+		if((*arg)->getKind() != AST_EXPRESSION_CALLOUT_ARG) {
+			return false;
+		}
+		if(!text.text.empty()) {
+			pieces.push_back(text);
+			text.text.clear();
+		}
+		FormatPiece conversion = { fmt[i], "", static_cast<ASTExpressionCalloutArg *>(*arg++)->getExpression() };
+		pieces.push_back(conversion);
+	}
+	if(!text.text.empty()) {
+		pieces.push_back(text);
+	}
+	return arg == args.end();
 }
 
+/*
+ * Callouts to printf with a literal format of text, %d, %c, %s and %% are
+ * lowered to the buffered writers of the runtime library, the format being
+ * parsed here once rather than by printf at every call. The arguments are
+ * all evaluated before anything is written, as for a call, and the result
+ * is the number of characters written, as printf's. Other callouts call
+ * the function itself, once the runtime has flushed its buffer so that the
+ * output stays in order.
+ */
 Value *EvaluateVisitor::visit(ASTCalloutMethodCallNode *node) {
-	string funcName = node->getFuncName();
-	list<ASTCalloutArg *> *args = node->getArgumentList();
-	list<ASTCalloutArg *>::iterator it;
+	StringRef funcName = node->getFuncName();
+	StringRef func = funcName.substr(1, funcName.size() - 2);
+	const ASTArray<ASTCalloutArg *> &args = node->getArgumentList();
+	ASTArray<ASTCalloutArg *>::iterator it;
+
+	vector<FormatPiece> pieces;
+	if(func == "printf" && !args.empty() && args.front()->getKind() == AST_STRING_CALLOUT_ARG
+			&& parseFormat(args, pieces)) {
+		vector<Value *> values;
+		for(unsigned i = 0; i < pieces.size(); i++) {
+			Value *v = nullptr;
+			if(pieces[i].conversion) {
+				v = dispatch(pieces[i].arg);
+				if(v->getType()->isPointerTy()) {
+					v = builder_.CreateLoad(v, "loadarg");
+				}
+				v = builder_.CreateZExt(v, builder_.getInt32Ty());
+			}
+			values.push_back(v);
+		}
+		Type *strArgs[] = { builder_.getInt8PtrTy(), builder_.getInt32Ty() };
+		Type *intArgs[] = { builder_.getInt32Ty() };
+		Constant *writeStr = getFunction("__decaf_write_str", FunctionType::get(builder_.getInt32Ty(), strArgs, false));
+		Constant *writeInt = getFunction("__decaf_write_int", FunctionType::get(builder_.getInt32Ty(), intArgs, false));
+		Constant *writeChar = getFunction("__decaf_write_char", FunctionType::get(builder_.getInt32Ty(), intArgs, false));
+		unsigned length = 0;
+		Value *written = nullptr;
+		for(unsigned i = 0; i < pieces.size(); i++) {
+			if(pieces[i].conversion == 'd') {
+				Value *n = builder_.CreateCall(writeInt, values[i], "written");
+				written = written ? builder_.CreateAdd(written, n, "written") : n;
+			}
+			else if(pieces[i].conversion == 'c') {
+				builder_.CreateCall(writeChar, values[i]);
+				length++;
+			}
+			else {
+				Value *strArgsV[] = { getString(pieces[i].text), builder_.getInt32(pieces[i].text.size()) };
+				builder_.CreateCall(writeStr, strArgsV);
+				length += pieces[i].text.size();
+			}
+		}
+		if(!written) {
+			return builder_.getInt32(length);
+		}
+		return length ? builder_.CreateAdd(written, builder_.getInt32(length), "print") : written;
+	}
+
 	vector<Value *> argsV;
-	Value *fmt;
-	for(it = args->begin(); it != args->end(); it++) {
-		Value *v = (*it)->accept(this);
-		if(it != args->begin()) {
+	for(it = args.begin(); it != args.end(); it++) {
+		Value *v = dispatch(*it);
+		if(it != args.begin()) {
 			if(v->getType()->isPointerTy()) {
-				v = Builder->CreateLoad(v, "loadarg");
+				v = builder_.CreateLoad(v, "loadarg");
 			}
 		}
 		argsV.push_back(v);
 	}
-	string func;
-	for(int i = 1; i < funcName.length() - 1; i++) {
-		func.push_back(funcName[i]);
-	}
 	vector<Type *> argTypes;
-	argTypes.push_back(Type::getInt8PtrTy(getGlobalContext()));
-	FunctionType *FT = FunctionType::get(Builder->getInt32Ty(), argTypes, true);
-	Constant *printFunc = DecafToLLVM->getOrInsertFunction(func, FT);
+	argTypes.push_back(Type::getInt8PtrTy(context_));
+	FunctionType *FT = FunctionType::get(builder_.getInt32Ty(), argTypes, true);
+	Constant *printFunc = getFunction(func, FT);
 
-	return Builder->CreateCall(printFunc, argsV, "print");
+	builder_.CreateCall(getFunction("__decaf_flush", FunctionType::get(builder_.getVoidTy(), false)));
+	return builder_.CreateCall(printFunc, argsV, "print");
 }
 
 Value *EvaluateVisitor::visit(ASTBlockStatementNode *node) {
 	ASTBlock *block = node->getBlock();
-	return block->accept(this);
+	return dispatch(block);
+}
+
+/* Declaration of an external function, made once per module */
+Constant *EvaluateVisitor::getFunction(StringRef name, FunctionType *FT) {
+	Constant *&F = functions_[name];
+	if(!F) {
+		F = module_->getOrInsertFunction(name, FT);
+	}
+	return F;
+}
+
+/* Pointer to a constant string, every string of the module being emitted once */
+Constant *EvaluateVisitor::getString(StringRef s) {
+	Constant *&str = strings_[s];
+	if(!str) {
+		str = cast<Constant>(builder_.CreateGlobalStringPtr(s, "fmt"));
+	}
+	return str;
 }
 
 /*
@@ -436,178 +1524,430 @@ Value *EvaluateVisitor::visit(ASTBlockStatementNode *node) {
  * which are loaded and then provided as arguments.
  */
 Value *EvaluateVisitor::visit(ASTStringCalloutArg *node) {
-	string out;
-	string in = node->getString();
-	for(int i = 1; i < in.length() - 1; i++) {
-		if(in[i] == '\\' && in[i+1] == 'n') {
-			out.push_back('\n');
-			i++;
-		}
-		else {
-			out.push_back(in[i]);
-		}
-	}
-	Value *formatStr = Builder->CreateGlobalStringPtr(out.c_str(), "fmt");
-	return formatStr;
+	return getString(unquote(node->getString()));
 }
 
 Value *EvaluateVisitor::visit(ASTExpressionCalloutArg *node) {
-	Value *v = node->getExpression()->accept(this);
+	Value *v = dispatch(node->getExpression());
 	return v;
 }
 
+/*
+ * Declares the variables of a FieldDeclList in the innermost scope.
+ */
+void EvaluateVisitor::declareFields(const ASTArray<ASTFieldDecl *> &fields) {
+	ASTArray<ASTFieldDecl *>::iterator it;
+	for(it = fields.begin(); it != fields.end(); it++) {
+		annotateSymbolTable((*it)->getType(), (*it)->getVariableList());
+	}
+}
+
+/*
+ * Every block is a scope : its local variables are visible only to its
+ * own statements.
+ */
 Value *EvaluateVisitor::visit(ASTBlock *node) {
-	list<ASTStatementDeclNode *> *s = node->getStatementList();
-	list<ASTStatementDeclNode *>::iterator it;
+	const ASTArray<ASTStatementDeclNode *> &s = node->getStatementList();
+	ASTArray<ASTStatementDeclNode *>::iterator it;
 
-	Value *v;
-	for(it = s->begin(); it != s->end(); it++) {
-		v = (*it)->accept(this);
+	symTable_.pushScope();
+	declareFields(node->getFieldDeclList());
+
+	Value *v = builder_.getInt32(0);
+	for(it = s.begin(); it != s.end(); it++) {
+		v = dispatch(*it);
 		if(!v) {					// If the return value is nullptr, then
 			break;					// do not process further statements.
 		}
 	}
+	symTable_.popScope();
 	return v;
 }
 
 static AllocaInst *CreateEntryBlockAlloca(Function *TheFunction, Type *ty,
-                                          const string &VarName) {
+                                          StringRef VarName) {
   IRBuilder<> TmpB(&TheFunction->getEntryBlock(),
                  TheFunction->getEntryBlock().begin());
   return TmpB.CreateAlloca(ty, 0,
-                           VarName.c_str());
+                           VarName);
 }
 
 /*
- * Function to create method declarations. Simple Enough.
+ * Declares the function of every method up front, so that a method can be
+ * called from a module that does not define it.
  */
-Value *EvaluateVisitor::visit(ASTMethodDeclNode *node) {
-	declStarted = true;
-	string name = node->getMethodName();
-	int val = node->getType();
-	Type *retType;
-	if(val == 1) {
-		retType = Builder->getInt32Ty();
-	}
-	else if (val == 2) {
-		retType = Builder->getInt1Ty();
-	}
-	else {
-		retType = Builder->getVoidTy();
-	}
-	vector<Type *> paramTypes;
-	vector<string> paramNames;
-	list<ASTParameterDecl *> *params = node->getParamList();
-	list<ASTParameterDecl *>::iterator it;
-	for(it = params->begin(); it != params->end(); it++) {
-		int t = (*it)->getType();
-		if(t == 1) {
-			paramTypes.push_back(Builder->getInt32Ty());
+void EvaluateVisitor::declareMethods(const ASTArray<ASTMethodDeclNode *> &methods) {
+	ASTArray<ASTMethodDeclNode *>::iterator m;
+	for(m = methods.begin(); m != methods.end(); m++) {
+		int val = (*m)->getType();
+		Type *retType;
+		if(val == 1) {
+			retType = builder_.getInt32Ty();
+		}
+		else if (val == 2) {
+			retType = builder_.getInt1Ty();
 		}
 		else {
-			paramTypes.push_back(Builder->getInt1Ty());
+			retType = builder_.getVoidTy();
+		}
+		vector<Type *> paramTypes;
+		const ASTArray<ASTParameterDecl *> &params = (*m)->getParamList();
+		ASTArray<ASTParameterDecl *>::iterator it;
+		for(it = params.begin(); it != params.end(); it++) {
+			paramTypes.push_back(getLLVMType(context_, (*it)->getType()));
 		}
-		paramNames.push_back((*it)->getVarName());
+		Ident id = (*m)->getMethodName();
+		methodTable_[id] = Function::Create(FunctionType::get(retType, paramTypes, false),
+								Function::ExternalLinkage, Session->getName(id), module_);
 	}
-	Function *F = Function::Create(FunctionType::get(retType, paramTypes, false),
-								Function::ExternalLinkage, name, DecafToLLVM);
-	symTable.insert(make_pair(name, F));
-	BasicBlock *BBlock = BasicBlock::Create(getGlobalContext(), name+"_1", F);
-	Builder->SetInsertPoint(BBlock);
+}
 
-	Function::arg_iterator args = F->arg_begin();
-	for(int i = 0; i < paramNames.size(); i++) {
-		AllocaInst *alloca = CreateEntryBlockAlloca(F, paramTypes[i], paramNames[i]);
-		Builder->CreateStore(args, alloca);
+/* Whether a block returns a call to the method, directly or in a nested block */
+static bool hasSelfTailCall(ASTBlock *block, Ident method) {
+	const ASTArray<ASTStatementDeclNode *> &s = block->getStatementList();
+	for(ASTArray<ASTStatementDeclNode *>::iterator it = s.begin(); it != s.end(); it++) {
+		switch((*it)->getKind()) {
+			case AST_RETURN_STATEMENT: {
+				ASTSimpleMethodCallNode *call = methodCall(static_cast<ASTReturnStatementNode *>(*it)->getReturnExpression());
+				if(call && call->getMethodName() == method) {
+					return true;
+				}
+				break;
+			}
+			case AST_BLOCK_STATEMENT:
+				if(hasSelfTailCall(static_cast<ASTBlockStatementNode *>(*it)->getBlock(), method)) {
+					return true;
+				}
+				break;
+			case AST_IF_STATEMENT: {
+				ASTIfStatementDeclNode *node = static_cast<ASTIfStatementDeclNode *>(*it);
+				if(hasSelfTailCall(node->getIfBlock(), method) ||
+						(node->getElseBlock() && hasSelfTailCall(node->getElseBlock(), method))) {
+					return true;
+				}
+				break;
+			}
+			case AST_FOR_STATEMENT:
+				if(hasSelfTailCall(static_cast<ASTForStatementDeclNode *>(*it)->getForBody(), method)) {
+					return true;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+	return false;
+}
+
+/*
+ * Function to create method definitions. Parameters are variables whose
+ * value on entry is the argument; only those that a parallel loop assigns
+ * are copied to memory.
+ *
+ * A method that returns calls to itself gets a block after the entry
+ * block for those calls to jump back to. It is sealed once the whole body
+ * is generated, like a loop header, so the parameters get phis there.
+ */
+Value *EvaluateVisitor::visit(ASTMethodDeclNode *node) {
+	declStarted_ = true;
+	Ident id = node->getMethodName();
+	StringRef name = Session->getName(id);
+	Function *F = methodTable_[id];
+	const ASTArray<ASTParameterDecl *> &params = node->getParamList();
+	BasicBlock *BBlock = BasicBlock::Create(context_, name+"_1", F);
+	startBlock(BBlock);
 
-		symTable[paramNames[i]] = alloca;
+	LoopBodyScan scan;
+	scan.dispatch(node->getBlock());
+	sharedVars_.swap(scan.shared_);
+
+	symTable_.pushScope();
+	Function::arg_iterator args = F->arg_begin();
+	for(int i = 0; i < params.size(); i++) {
+		Ident paramId = params[i]->getVarName();
+		StringRef paramName = Session->getName(paramId);
+		if(sharedVars_.count(paramId)) {
+			AllocaInst *alloca = CreateEntryBlockAlloca(F, args->getType(), paramName);
+			builder_.CreateStore(args, alloca);
+			symTable_.insert(paramId, alloca);
+			params_.push_back(make_pair(-1, alloca));
+		}
+		else {
+			unsigned var = newVariable(args->getType(), paramName);
+			writeVariable(var, BBlock, args);
+			symTable_.insertVariable(paramId, var);
+			params_.push_back(make_pair((int)var, (AllocaInst *)nullptr));
+		}
 		Value *x = args++;
-		x->setName(paramNames[i]);
+		x->setName(paramName);
 	}
 	ASTBlock *block;
 	block = node->getBlock();
-	block->accept(this);
+	if(hasSelfTailCall(block, id)) {
+		recurseBB_ = BasicBlock::Create(context_, "tailrecurse", F);
+		builder_.CreateBr(recurseBB_);
+		builder_.SetInsertPoint(recurseBB_);
+	}
+	dispatch(block);
+	if(recurseBB_) {
+		sealBlock(recurseBB_);
+		recurseBB_ = nullptr;
+	}
+	symTable_.popScope();
+	params_.clear();
+
+	variables_.clear();
+	currentDef_.clear();
+	incompletePhis_.clear();
+	sealed_.clear();
+	variablePhis_.clear();
 	return F;
 }
 
-Value *EvaluateVisitor::visit(ASTProgramNode *node) {
-	list<ASTMethodDeclNode *> *s = node->getMethodDeclList();
-	list<ASTMethodDeclNode *>::iterator iter;
-	for(iter = s->begin(); iter != s->end(); iter++) {
-		Value *v = (*iter)->accept(this);
+/*
+ * The fields of the class are the outermost scope, which is open for
+ * the whole program. Only methods [first, last) get a body in this module.
+ */
+void EvaluateVisitor::generate(ASTProgramNode *node, unsigned first, unsigned last) {
+	const ASTArray<ASTMethodDeclNode *> &s = node->getMethodDeclList();
+	symTable_.pushScope();
+	declStarted_ = false;
+	declareFields(node->getFieldDeclList());
+	if(first < last) {
+		declareMethods(s);
 	}
+	for(unsigned i = first; i < last; i++) {
+		dispatch(s[i]);
+	}
+	symTable_.popScope();
+}
+
+Value *EvaluateVisitor::visit(ASTProgramNode *node) {
+	generate(node, 0, node->getMethodDeclList().size());
 	return nullptr;
 }
 
-AllocaInst *defineVariable(Type *llvmTy, Value *v, string id) {
-	Value *arraySize = 0;
+/*
+ * Local arrays, and the scalars that a parallel loop assigns, are
+ * allocated in the entry block of the method, so a declaration inside a
+ * loop does not grow the stack on every iteration. Like fields, they start
+ * out zeroed every time their block is entered. Other scalars are SSA
+ * variables (see readVariable).
+ */
+AllocaInst *EvaluateVisitor::defineVariable(Type *llvmTy, Value *v, StringRef id) {
+	Function *F = builder_.GetInsertBlock()->getParent();
+	IRBuilder<> TmpB(&F->getEntryBlock(), F->getEntryBlock().begin());
 	int align = 4;
 	if(v) {
-		arraySize = v;
+		llvmTy = ArrayType::get(llvmTy, dyn_cast<ConstantInt>(v)->getSExtValue());
 		align = 16;
 	}
-	AllocaInst *Alloca = Builder->CreateAlloca(llvmTy, arraySize, id.c_str());
+	AllocaInst *Alloca = TmpB.CreateAlloca(llvmTy, 0, id);
 	Alloca->setAlignment(align);
+	if(v) {
+		builder_.CreateMemSet(Alloca, builder_.getInt8(0), ConstantExpr::getSizeOf(llvmTy), align);
+	}
+	else {
+		builder_.CreateStore(Constant::getNullValue(llvmTy), Alloca);
+	}
 	return Alloca;
 }
 
 /*
- * Function to declare and store the global variables / allocas in the
- * symbol Table.
+ * SSA construction, after Braun et al., "Simple and Efficient Construction
+ * of Static Single Assignment Form". The scalar locals and parameters of a
+ * method are variables with a current value in every block, and no memory
+ * is involved : an assignment records its value as the variable's value
+ * in the block it ends in, and a read looks the value up, in the block or
+ * else in its predecessors, placing a phi where they may disagree.
+ *
+ * A block is sealed once all of its predecessors are known, which is when
+ * code starts to be generated in it (startBlock), except for a loop header
+ * whose back edges come after its body. A read in a block that is not
+ * sealed places a phi with no operands yet, filled in when the block is
+ * sealed. A phi whose operands are all one value (or itself) is replaced
+ * by that value, and the complete phis that used it are checked in turn
+ * (one that is still getting its operands is checked when it has them
+ * all), so no phi is left where a single definition reaches.
  */
-void annotateSymbolTable(int datatype, list<Symbol*> *variableList) {
-	if(!declStarted) {
-		list<Symbol*>::iterator iter;
-		EvaluateVisitor v_;
-		bool isArray = false;
-		for(iter = variableList->begin(); iter != variableList->end(); iter++) {
+unsigned EvaluateVisitor::newVariable(Type *ty, StringRef name) {
+	Variable v = { ty, name };
+	variables_.push_back(v);
+	return variables_.size() - 1;
+}
+
+void EvaluateVisitor::writeVariable(unsigned var, BasicBlock *BB, Value *v) {
+	currentDef_[make_pair(BB, var)] = v;
+}
+
+Value *EvaluateVisitor::readVariable(unsigned var, BasicBlock *BB) {
+	map<pair<BasicBlock *, unsigned>, TrackingVH<Value> >::iterator it = currentDef_.find(make_pair(BB, var));
+	if(it != currentDef_.end()) {
+		return it->second;
+	}
+	return readVariableRecursive(var, BB);
+}
+
+Value *EvaluateVisitor::readVariableRecursive(unsigned var, BasicBlock *BB) {
+	Variable &v = variables_[var];
+	Value *val;
+	if(!sealed_.count(BB)) {
+		PHINode *phi = BB->empty() ? PHINode::Create(v.type, 2, v.name, BB) : PHINode::Create(v.type, 2, v.name, &BB->front());
+		incompletePhis_[BB].push_back(make_pair(var, phi));
+		val = phi;
+	}
+	else if(BasicBlock *pred = BB->getSinglePredecessor()) {
+		val = readVariable(var, pred);
+	}
+	else if(pred_begin(BB) == pred_end(BB)) {
+		val = UndefValue::get(v.type);		// Only unreachable code gets here
+	}
+	else {
+		// The phi breaks cycles through loops
+		PHINode *phi = BB->empty() ? PHINode::Create(v.type, 2, v.name, BB) : PHINode::Create(v.type, 2, v.name, &BB->front());
+		writeVariable(var, BB, phi);
+		val = addPhiOperands(var, phi);
+	}
+	writeVariable(var, BB, val);
+	return val;
+}
+
+Value *EvaluateVisitor::addPhiOperands(unsigned var, PHINode *phi) {
+	BasicBlock *BB = phi->getParent();
+	for(pred_iterator it = pred_begin(BB); it != pred_end(BB); it++) {
+		phi->addIncoming(readVariable(var, *it), *it);
+	}
+	variablePhis_.insert(phi);
+	return removeTrivialPhi(phi);
+}
+
+Value *EvaluateVisitor::removeTrivialPhi(PHINode *phi) {
+	Value *same = nullptr;
+	for(unsigned i = 0; i < phi->getNumIncomingValues(); i++) {
+		Value *op = phi->getIncomingValue(i);
+		if(op == same || op == phi) {
+			continue;
+		}
+		if(same) {
+			return phi;				// Merges two values at least
+		}
+		same = op;
+	}
+	if(!same) {
+		same = UndefValue::get(phi->getType());
+	}
+	SmallVector<WeakVH, 8> users;
+	for(Value::user_iterator it = phi->user_begin(); it != phi->user_end(); it++) {
+		PHINode *user = dyn_cast<PHINode>(*it);
+		if(user && user != phi && variablePhis_.count(user)) {
+			users.push_back(user);
+		}
+	}
+	phi->replaceAllUsesWith(same);
+	variablePhis_.erase(phi);
+	phi->eraseFromParent();
+	// same may be one of the users, and be replaced in turn
+	TrackingVH<Value> result(same);
+	for(unsigned i = 0; i < users.size(); i++) {
+		PHINode *user = dyn_cast_or_null<PHINode>(users[i]);
+		if(user && variablePhis_.count(user)) {
+			removeTrivialPhi(user);
+		}
+	}
+	return result;
+}
+
+void EvaluateVisitor::sealBlock(BasicBlock *BB) {
+	if(!sealed_.insert(BB).second) {
+		return;
+	}
+	map<BasicBlock *, vector<pair<unsigned, PHINode *> > >::iterator it = incompletePhis_.find(BB);
+	if(it != incompletePhis_.end()) {
+		vector<pair<unsigned, PHINode *> > phis;
+		phis.swap(it->second);
+		incompletePhis_.erase(it);
+		for(unsigned i = 0; i < phis.size(); i++) {
+			addPhiOperands(phis[i].first, phis[i].second);
+		}
+	}
+}
+
+/* Generates code in a block from now on. All of its predecessors are known */
+void EvaluateVisitor::startBlock(BasicBlock *BB) {
+	builder_.SetInsertPoint(BB);
+	sealBlock(BB);
+}
+
+/*
+ * Function to declare the global variables / allocas and bind them in the
+ * innermost scope of the symbol Table. A module that does not own the
+ * fields only declares them; the linker resolves them to the definitions.
+ */
+void EvaluateVisitor::annotateSymbolTable(int datatype, const ASTArray<Symbol *> &variableList) {
+	if(!declStarted_) {
+		ASTArray<Symbol *>::iterator iter;
+		for(iter = variableList.begin(); iter != variableList.end(); iter++) {
 			Symbol *sym = *iter;
+			bool isArray = false;
 			Value *v = nullptr;
 			if(sym->literal_ != 0) {
-				v = sym->literal_->accept(&v_);
+				v = dispatch(sym->literal_);
 				isArray = true;
 			}
 			ConstantInt *c;
 			if(v) {
 				c = dyn_cast<ConstantInt>(v);
 			}
-			Type *ty = getLLVMType(datatype);
+			Type *ty = getLLVMType(context_, datatype);
 			GlobalVariable *var;
-			if(!isArray) {
-				var = new GlobalVariable(*DecafToLLVM, ty, false, GlobalValue::CommonLinkage,
-														0, sym->id_.c_str());
+			if(!ownsFields_) {
+				if(isArray) {
+					ty = ArrayType::get(ty, c->getSExtValue());
+				}
+				var = new GlobalVariable(*module_, ty, false, GlobalValue::ExternalLinkage,
+														0, Session->getName(sym->id_));
+			}
+			else if(!isArray) {
+				var = new GlobalVariable(*module_, ty, false, GlobalValue::CommonLinkage,
+														0, Session->getName(sym->id_));
 				var->setAlignment(4);
 				if(ty->isIntegerTy(32)) {
-					var->setInitializer(Builder->getInt32(0));
+					var->setInitializer(builder_.getInt32(0));
 				}
 				else {
-					var->setInitializer(Builder->getInt1(0));
+					var->setInitializer(builder_.getInt1(0));
 				}
 			}
 			else {
 				ArrayType* ArrayTy_0 = ArrayType::get(ty, c->getSExtValue());
 				PointerType* PointerTy_1 = PointerType::get(ArrayTy_0, 0);
-				var = new GlobalVariable(*DecafToLLVM, ArrayTy_0, false, GlobalValue::CommonLinkage,
-														0, sym->id_.c_str());
+				var = new GlobalVariable(*module_, ArrayTy_0, false, GlobalValue::CommonLinkage,
+														0, Session->getName(sym->id_));
 				var->setAlignment(16);
 				ConstantAggregateZero* const_array_2 = ConstantAggregateZero::get(ArrayTy_0);
 				var->setInitializer(const_array_2);
 			}
-			symTable.insert(make_pair(sym->id_, var));
+			symTable_.insert(sym->id_, var);
 		}
 	}
 	else {
-		list<Symbol*>::iterator iter;
-		EvaluateVisitor v_;
-		for(iter = variableList->begin(); iter != variableList->end(); iter++) {
+		ASTArray<Symbol *>::iterator iter;
+		for(iter = variableList.begin(); iter != variableList.end(); iter++) {
 			Symbol *sym = *iter;
 			Value *v = nullptr;
 			if(sym->literal_ != 0) {
-				v = sym->literal_->accept(&v_);
+				v = dispatch(sym->literal_);
+			}
+			Type *ty = getLLVMType(context_, datatype);
+			StringRef name = Session->getName(sym->id_);
+			if(v || sharedVars_.count(sym->id_)) {
+				symTable_.insert(sym->id_, defineVariable(ty, v, name));
+			}
+			else {
+				unsigned var = newVariable(ty, name);
+				writeVariable(var, builder_.GetInsertBlock(), Constant::getNullValue(ty));
+				symTable_.insertVariable(sym->id_, var);
 			}
-			Type *ty = getLLVMType(datatype);
-			AllocaInst *alloca = defineVariable(ty, v, sym->id_);
-			symTable.insert(make_pair(sym->id_, alloca));
 		}
 	}
 }
@@ -0,0 +1,167 @@
+/*
+ * Micro-benchmark for AST traversal. Builds a large synthetic AST in a
+ * compilation session and walks all of it repeatedly with two visitors
+ * that do the same work (count the nodes):
+ *
+ *   virtual : a Visitor reached through ASTNode::accept, i.e. two virtual
+ *             calls per node (the dispatch EvaluateVisitor used to have)
+ *   kind    : an ASTVisitorBase visitor, which switches on getKind()
+ *
+ * Usage : bench/ast_traversal [methods] [statements per method] [rounds]
+ */
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include "../include/ast.h"
+#include "../include/session.h"
+#include "counting_walk.h"
+using namespace std;
+
+#define FORWARD(T) Value *visit(T *node) override { return CountingWalk<VirtualCounter>::visit(node); }
+
+class VirtualCounter : public Visitor, public CountingWalk<VirtualCounter> {
+	public:
+		Value *walk(ASTNode *node) {
+			return node->accept(this);
+		}
+		FORWARD(ASTAssignmentStatementNode)
+		FORWARD(ASTVarLocationNode)
+		FORWARD(ASTArrayLocationNode)
+		FORWARD(ASTProgramNode)
+		FORWARD(ASTBlock)
+		FORWARD(ASTMethodDeclNode)
+		FORWARD(ASTSimpleMethodCallNode)
+		FORWARD(ASTCalloutMethodCallNode)
+		FORWARD(ASTIfStatementDeclNode)
+		FORWARD(ASTForStatementDeclNode)
+		FORWARD(ASTReturnStatementNode)
+		FORWARD(ASTBreakStatementNode)
+		FORWARD(ASTContinueStatementNode)
+		FORWARD(ASTBlockStatementNode)
+		FORWARD(ASTExpressionCalloutArg)
+		FORWARD(ASTStringCalloutArg)
+		FORWARD(ASTMethodCallExpressionNode)
+		FORWARD(ASTIntegerLiteralExpressionNode)
+		FORWARD(ASTBoolLiteralExpressionNode)
+		FORWARD(ASTCharLiteralExpressionNode)
+		FORWARD(ASTLocationExpressionNode)
+		FORWARD(ASTBinaryExpressionNode)
+		FORWARD(ASTUnaryExpressionNode)
+};
+
+class KindCounter : public ASTVisitorBase<KindCounter>, public CountingWalk<KindCounter> {
+	public:
+		using CountingWalk<KindCounter>::visit;
+		Value *walk(ASTNode *node) {
+			return dispatch(node);
+		}
+};
+
+/* Synthetic program : the statement mix is roughly that of tests/ */
+static unsigned seed = 12345;
+static unsigned nextRandom() {
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+static ASTExpressionNode *makeExpr(int depth) {
+	if(depth == 0 || nextRandom() % 4 == 0) {
+		switch(nextRandom() % 3) {
+			case 0:
+				return Session->make<ASTIntegerLiteralExpressionNode>((int)(nextRandom() % 100));
+			case 1:
+				return Session->make<ASTLocationExpressionNode>(Session->make<ASTVarLocationNode>(nextRandom() % 16));
+			default:
+				return Session->make<ASTLocationExpressionNode>(
+					Session->make<ASTArrayLocationNode>(nextRandom() % 16, makeExpr(0)));
+		}
+	}
+	static const int ops[] = { _plus, _minus, _mult, _lt, _eq, _and };
+	if(nextRandom() % 8 == 0) {
+		return Session->make<ASTUnaryExpressionNode>(makeExpr(depth - 1), _unaryminus);
+	}
+	return Session->make<ASTBinaryExpressionNode>(makeExpr(depth - 1), makeExpr(depth - 1),
+													ops[nextRandom() % 6]);
+}
+
+static ASTBlock *makeBlock(int statements, int depth);
+
+static ASTStatementDeclNode *makeStatement(int depth) {
+	unsigned r = nextRandom() % 10;
+	if(depth > 0 && r == 0) {
+		return Session->make<ASTIfStatementDeclNode>(makeExpr(2), makeBlock(3, depth - 1), makeBlock(2, depth - 1));
+	}
+	if(depth > 0 && r == 1) {
+		return Session->make<ASTForStatementDeclNode>(nextRandom() % 16, makeExpr(1), makeExpr(2), makeBlock(4, depth - 1));
+	}
+	if(r == 2) {
+		ListBuilder *args = Session->newListBuilder();
+		args->push_back(Session->make<ASTStringCalloutArg>(StringRef("\"%d\\n\"")));
+		args->push_back(Session->make<ASTExpressionCalloutArg>(makeExpr(2)));
+		return Session->make<ASTCalloutMethodCallNode>(StringRef("\"printf\""), Session->finishList<ASTCalloutArg>(args));
+	}
+	if(r == 3) {
+		ListBuilder *args = Session->newListBuilder();
+		args->push_back(makeExpr(2));
+		args->push_back(makeExpr(2));
+		return Session->make<ASTSimpleMethodCallNode>(nextRandom() % 16, Session->finishList<ASTExpressionNode>(args));
+	}
+	return Session->make<ASTAssignmentStatementNode>(Session->make<ASTVarLocationNode>(nextRandom() % 16),
+													_assign, makeExpr(3));
+}
+
+static ASTBlock *makeBlock(int statements, int depth) {
+	ListBuilder *s = Session->newListBuilder();
+	for(int i = 0; i < statements; i++) {
+		s->push_back(makeStatement(depth));
+	}
+	return Session->make<ASTBlock>(ASTArray<ASTFieldDecl *>(), Session->finishList<ASTStatementDeclNode>(s));
+}
+
+static ASTProgramNode *makeProgram(int methods, int statements) {
+	ListBuilder *m = Session->newListBuilder();
+	for(int i = 0; i < methods; i++) {
+		m->push_back(Session->make<ASTMethodDeclNode>(_int_, (Ident)i, ASTArray<ASTParameterDecl *>(),
+													makeBlock(statements, 2)));
+	}
+	return Session->make<ASTProgramNode>(ASTArray<ASTFieldDecl *>(), Session->finishList<ASTMethodDeclNode>(m));
+}
+
+template <typename Counter>
+static double timeTraversal(ASTProgramNode *root, int rounds, unsigned long *nodes) {
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	unsigned long total = 0;
+	for(int i = 0; i < rounds; i++) {
+		Counter c;
+		c.walk(root);
+		total += c.nodes_;
+	}
+	*nodes = total;
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+	int methods = argc > 1 ? atoi(argv[1]) : 2000;
+	int statements = argc > 2 ? atoi(argv[2]) : 50;
+	int rounds = argc > 3 ? atoi(argv[3]) : 20;
+
+	Session = new CompilationSession();
+	ASTProgramNode *root = makeProgram(methods, statements);
+
+	unsigned long vNodes, kNodes;
+	// Warm up the caches once so that neither visitor pays for first touch
+	timeTraversal<KindCounter>(root, 1, &kNodes);
+	double vTime = timeTraversal<VirtualCounter>(root, rounds, &vNodes);
+	double kTime = timeTraversal<KindCounter>(root, rounds, &kNodes);
+
+	printf("AST : %lu nodes, %.1f MB arena\n", kNodes / rounds, Session->getBytesAllocated() / 1048576.0);
+	printf("virtual accept/visit : %8.3f s  %8.2f Mnodes/s\n", vTime, vNodes / vTime / 1e6);
+	printf("kind dispatch        : %8.3f s  %8.2f Mnodes/s\n", kTime, kNodes / kTime / 1e6);
+	printf("speedup              : %8.2fx\n", vTime / kTime);
+	if(vNodes != kNodes) {
+		printf("node counts differ (%lu vs %lu)\n", vNodes, kNodes);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Times every phase of compiling Decaf programs, to see how the front end
+ * and the back end scale with the size of the input (see gen_decaf) :
+ *
+ *   scan      the lexer on its own, over the whole file
+ *   parse     lexer and parser, building the AST
+ *   irgen     FoldConstants, then EvaluateVisitor, i.e. BuildIR on -j threads
+ *   verify    the IR verifier
+ *   optimize  the -O pipeline
+ *   codegen   native object code, written to a temporary file
+ *
+ * Every phase is run rounds times and the best time is kept. Throughput is
+ * given in source lines and AST nodes per second of that phase.
+ *
+ * Usage : bench/compile_phases [-O0|-O1|-O2|-O3] [-j jobs] [-r rounds] file...
+ */
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "../include/ast.h"
+#include "../include/session.h"
+#include "../include/parser.h"
+#include "../include/fold.h"
+#include "../include/optimize.h"
+#include "../include/emit.h"
+#include "counting_walk.h"
+using namespace std;
+
+class NodeCounter : public ASTVisitorBase<NodeCounter>, public CountingWalk<NodeCounter> {
+	public:
+		using CountingWalk<NodeCounter>::visit;
+		Value *walk(ASTNode *node) {
+			return dispatch(node);
+		}
+};
+
+enum Phase { SCAN, PARSE, IRGEN, VERIFY, OPTIMIZE, CODEGEN, NUM_PHASES };
+static const char *PhaseNames[] = { "scan", "parse", "irgen", "verify", "optimize", "codegen" };
+
+struct FileStats {
+	unsigned long lines, bytes, tokens, nodes;
+	double best[NUM_PHASES];
+};
+
+class Timer {
+	public:
+		Timer() : start_(chrono::steady_clock::now()) {}
+		double seconds() const {
+			return chrono::duration<double>(chrono::steady_clock::now() - start_).count();
+		}
+	private:
+		chrono::steady_clock::time_point start_;
+};
+
+static void record(FileStats &stats, Phase phase, double seconds) {
+	if(seconds < stats.best[phase]) {
+		stats.best[phase] = seconds;
+	}
+}
+
+/* One compilation of the file, timing each phase. Returns false if it fails to compile. */
+static bool compileOnce(const char *path, int level, unsigned jobs, TargetMachine *TM, FileStats &stats) {
+	FILE *in = fopen(path, "r");
+	if(!in) {
+		cerr << "Cannot open " << path << endl;
+		return false;
+	}
+
+	Session = new CompilationSession();
+	Timer scan;
+	int tokens = ScanProgram(in, path);
+	record(stats, SCAN, scan.seconds());
+	delete Session;
+	rewind(in);
+
+	LLVMContext Context;
+	Session = new CompilationSession();
+	Timer parse;
+	ASTProgramNode *root = ParseProgram(in, path);
+	record(stats, PARSE, parse.seconds());
+	fclose(in);
+	if(!root) {
+		delete Session;
+		return false;
+	}
+	NodeCounter counter;
+	counter.walk(root);
+	stats.tokens = tokens;
+	stats.nodes = counter.nodes_;
+
+	Timer irgen;
+	FoldConstants(root);
+	Module *M = BuildIR(root, path, jobs, Context);
+	record(stats, IRGEN, irgen.seconds());
+	delete Session;
+	Session = nullptr;
+	if(!M) {
+		return false;
+	}
+
+	Timer verify;
+	bool ok = VerifyIR(M);
+	record(stats, VERIFY, verify.seconds());
+
+	if(ok) {
+		PrepareModuleForTarget(M, TM);
+		Timer optimize;
+		ok = OptimizeModule(M, level, "", TM);
+		record(stats, OPTIMIZE, optimize.seconds());
+	}
+
+	SmallString<128> obj;
+	if(ok && !sys::fs::createTemporaryFile("decaf-bench", "o", obj)) {
+		Timer codegen;
+		ok = EmitNativeFile(M, TM, obj.str(), false);
+		record(stats, CODEGEN, codegen.seconds());
+		sys::fs::remove(obj.str());
+	}
+	delete M;
+	return ok;
+}
+
+static void countLines(const char *path, FileStats &stats) {
+	stats.lines = stats.bytes = 0;
+	FILE *in = fopen(path, "r");
+	if(!in) {
+		return;
+	}
+	int c;
+	while((c = getc(in)) != EOF) {
+		stats.bytes++;
+		stats.lines += c == '\n';
+	}
+	fclose(in);
+}
+
+static void report(const char *path, const FileStats &stats) {
+	printf("%s : %lu lines, %.1f KB, %lu tokens, %lu AST nodes\n", path, stats.lines, stats.bytes / 1024.0,
+		   stats.tokens, stats.nodes);
+	printf("  %-9s %10s %14s %14s\n", "phase", "best ms", "klines/s", "knodes/s");
+	double total = 0;
+	for(int p = 0; p < NUM_PHASES; p++) {
+		// Parsing includes scanning, so only one of them counts in the total
+		if(p != SCAN) {
+			total += stats.best[p];
+		}
+		printf("  %-9s %10.3f %14.1f %14.1f\n", PhaseNames[p], stats.best[p] * 1e3,
+			   stats.lines / stats.best[p] / 1e3, stats.nodes / stats.best[p] / 1e3);
+	}
+	printf("  %-9s %10.3f %14.1f %14.1f\n", "total", total * 1e3, stats.lines / total / 1e3, stats.nodes / total / 1e3);
+}
+
+static void usage(const char *prog) {
+	cerr << "Usage: " << prog << " [-O0|-O1|-O2|-O3] [-j jobs] [-r rounds] file..." << endl;
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	int level = 0, rounds = 3;
+	unsigned jobs = thread::hardware_concurrency();
+	vector<const char *> files;
+	for(int i = 1; i < argc; i++) {
+		if(strlen(argv[i]) == 3 && strncmp(argv[i], "-O", 2) == 0 && argv[i][2] >= '0' && argv[i][2] <= '3') {
+			level = argv[i][2] - '0';
+		}
+		else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			jobs = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			rounds = atoi(argv[++i]);
+		}
+		else if(argv[i][0] == '-') {
+			usage(argv[0]);
+		}
+		else {
+			files.push_back(argv[i]);
+		}
+	}
+	if(files.empty() || rounds < 1) {
+		usage(argv[0]);
+	}
+	if(jobs == 0) {
+		jobs = 1;
+	}
+
+	InitializeNativeTarget();
+	InitializeNativeTargetAsmPrinter();
+	TargetMachine *TM = CreateHostTargetMachine(level);
+	if(!TM) {
+		return 1;
+	}
+
+	printf("-O%d, %u jobs, best of %d rounds\n", level, jobs, rounds);
+	bool ok = true;
+	for(unsigned f = 0; f < files.size(); f++) {
+		FileStats stats;
+		countLines(files[f], stats);
+		for(int p = 0; p < NUM_PHASES; p++) {
+			stats.best[p] = 1e30;
+		}
+		bool compiled = true;
+		for(int r = 0; r < rounds && compiled; r++) {
+			compiled = compileOnce(files[f], level, jobs, TM, stats);
+		}
+		if(!compiled) {
+			cerr << files[f] << " does not compile" << endl;
+			ok = false;
+			continue;
+		}
+		report(files[f], stats);
+	}
+	delete TM;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+#ifndef __COUNTING_WALK_H__
+#define __COUNTING_WALK_H__
+
+#include "../include/ast.h"
+
+/*
+ * Walks every node of an AST and counts them. Self provides walk(node),
+ * which decides how a child is reached (a virtual accept or a kind
+ * dispatch), so that the benchmarks can compare the two on the same work.
+ */
+template <typename Self>
+class CountingWalk {
+	public:
+		CountingWalk() : nodes_(0) {}
+		unsigned long nodes_;
+
+		Value *visit(ASTProgramNode *node) {
+			nodes_++;
+			const ASTArray<ASTMethodDeclNode *> &m = node->getMethodDeclList();
+			for(ASTArray<ASTMethodDeclNode *>::iterator it = m.begin(); it != m.end(); it++) {
+				self()->walk(*it);
+			}
+			return nullptr;
+		}
+		Value *visit(ASTMethodDeclNode *node) {
+			nodes_++;
+			return self()->walk(node->getBlock());
+		}
+		Value *visit(ASTBlock *node) {
+			nodes_++;
+			const ASTArray<ASTStatementDeclNode *> &s = node->getStatementList();
+			for(ASTArray<ASTStatementDeclNode *>::iterator it = s.begin(); it != s.end(); it++) {
+				self()->walk(*it);
+			}
+			return nullptr;
+		}
+		Value *visit(ASTBlockStatementNode *node) {
+			nodes_++;
+			return self()->walk(node->getBlock());
+		}
+		Value *visit(ASTAssignmentStatementNode *node) {
+			nodes_++;
+			self()->walk(node->getLocation());
+			return self()->walk(node->getExpression());
+		}
+		Value *visit(ASTSimpleMethodCallNode *node) {
+			nodes_++;
+			const ASTArray<ASTExpressionNode *> &e = node->getExpressionList();
+			for(ASTArray<ASTExpressionNode *>::iterator it = e.begin(); it != e.end(); it++) {
+				self()->walk(*it);
+			}
+			return nullptr;
+		}
+		Value *visit(ASTCalloutMethodCallNode *node) {
+			nodes_++;
+			const ASTArray<ASTCalloutArg *> &a = node->getArgumentList();
+			for(ASTArray<ASTCalloutArg *>::iterator it = a.begin(); it != a.end(); it++) {
+				self()->walk(*it);
+			}
+			return nullptr;
+		}
+		Value *visit(ASTIfStatementDeclNode *node) {
+			nodes_++;
+			self()->walk(node->getIfExpression());
+			self()->walk(node->getIfBlock());
+			if(node->getElseBlock()) {
+				self()->walk(node->getElseBlock());
+			}
+			return nullptr;
+		}
+		Value *visit(ASTForStatementDeclNode *node) {
+			nodes_++;
+			self()->walk(node->getInitExpression());
+			self()->walk(node->getFinalExpression());
+			return self()->walk(node->getForBody());
+		}
+		Value *visit(ASTReturnStatementNode *node) {
+			nodes_++;
+			return self()->walk(node->getReturnExpression());
+		}
+		Value *visit(ASTBreakStatementNode *node) {
+			nodes_++;
+			return nullptr;
+		}
+		Value *visit(ASTContinueStatementNode *node) {
+			nodes_++;
+			return nullptr;
+		}
+		Value *visit(ASTVarLocationNode *node) {
+			nodes_++;
+			return nullptr;
+		}
+		Value *visit(ASTArrayLocationNode *node) {
+			nodes_++;
+			return self()->walk(node->getExpression());
+		}
+		Value *visit(ASTExpressionCalloutArg *node) {
+			nodes_++;
+			return self()->walk(node->getExpression());
+		}
+		Value *visit(ASTStringCalloutArg *node) {
+			nodes_++;
+			return nullptr;
+		}
+		Value *visit(ASTMethodCallExpressionNode *node) {
+			nodes_++;
+			return self()->walk(node->getMethodCallStatement());
+		}
+		Value *visit(ASTIntegerLiteralExpressionNode *node) {
+			nodes_++;
+			return nullptr;
+		}
+		Value *visit(ASTBoolLiteralExpressionNode *node) {
+			nodes_++;
+			return nullptr;
+		}
+		Value *visit(ASTCharLiteralExpressionNode *node) {
+			nodes_++;
+			return nullptr;
+		}
+		Value *visit(ASTLocationExpressionNode *node) {
+			nodes_++;
+			return self()->walk(node->getLocation());
+		}
+		Value *visit(ASTBinaryExpressionNode *node) {
+			nodes_++;
+			self()->walk(node->left);
+			return self()->walk(node->right);
+		}
+		Value *visit(ASTUnaryExpressionNode *node) {
+			nodes_++;
+			return self()->walk(node->right);
+		}
+
+	private:
+		Self *self() {
+			return static_cast<Self *>(this);
+		}
+};
+
+#endif
@@ -0,0 +1,408 @@
+/*
+ * Generator of large synthetic Decaf programs, for timing the compiler on
+ * inputs far bigger than tests/. The program is valid and terminates :
+ * array indices are literals or loop counters below the array size, and
+ * every method takes a fuel argument that bounds the depth of its calls.
+ *
+ * Usage : bench/gen_decaf [--option=value ...] > program
+ *
+ *   --methods     methods besides main (default 100)
+ *   --statements  statements in the body of each method (default 20)
+ *   --depth       depth of the expression trees (default 3)
+ *   --nesting     how deep for loops and if statements nest (default 2)
+ *   --arrays      global int arrays (default 4)
+ *   --scalars     global int variables (default 8)
+ *   --callouts    percentage of the statements that are printf callouts (default 10)
+ *   --calls       percentage of the operands that are method calls (default 5)
+ *   --trip        iterations of every for loop (default 8)
+ *   --seed        seed of the random choices (default 1)
+ *
+ * The same options and seed always give the same program. The number of
+ * lines and methods is printed on stderr.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct GenOptions {
+	int methods;
+	int statements;
+	int depth;
+	int nesting;
+	int arrays;
+	int scalars;
+	int callouts;
+	int calls;
+	int trip;
+	unsigned seed;
+};
+
+static const int ArraySize = 100;
+
+class Generator {
+	public:
+		Generator(const GenOptions &opts) : opts_(opts), seed_(opts.seed), lines_(0), indent_(0), calls_(0) {}
+
+		void program();
+		int getLines() const {
+			return lines_;
+		}
+
+	private:
+		const GenOptions &opts_;
+		unsigned seed_;
+		int lines_;
+		int indent_;
+		int calls_;							// Calls being generated, to bound their nesting
+		vector<int> arity_;					// Parameters of every method, besides fuel
+		vector<string> ints_;				// Assignable int variables in scope
+		vector<string> counters_;			// Loop counters in scope, readable only
+
+		unsigned random(unsigned n) {
+			seed_ = seed_ * 1103515245 + 12345;
+			return ((seed_ >> 8) & 0x7fffff) % n;
+		}
+		bool percent(int p) {
+			return (int)random(100) < p;
+		}
+
+		/* Starts a line at the current indentation; line() ends it */
+		void begin() {
+			for(int i = 0; i < indent_; i++) {
+				putchar('\t');
+			}
+		}
+		void line(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+		void method(int index);
+		void block(int statements, int nesting);
+		void statement(int nesting);
+		void call(int depth);
+		void expr(int depth);
+		void condition(int depth);
+		void index();
+};
+
+void Generator::line(const char *fmt, ...) {
+	begin();
+	va_list ap;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	putchar('\n');
+	lines_++;
+}
+
+/* A call of any method, with less fuel than the caller had */
+void Generator::call(int depth) {
+	int callee = random(opts_.methods);
+	printf("m%d(fuel - 1", callee);
+	calls_++;
+	for(int i = 0; i < arity_[callee]; i++) {
+		printf(", ");
+		expr(depth > 0 ? depth - 1 : 0);
+	}
+	calls_--;
+	putchar(')');
+}
+
+/* An array index that is always in bounds */
+void Generator::index() {
+	if(!counters_.empty() && random(2)) {
+		printf("%s", counters_[random(counters_.size())].c_str());
+	}
+	else {
+		printf("%u", random(ArraySize));
+	}
+}
+
+/* An int expression, fully parenthesized : the grammar ranks && below < */
+void Generator::expr(int depth) {
+	if(depth == 0 || random(4) == 0) {
+		unsigned r = random(10);
+		if(opts_.methods > 0 && calls_ < 2 && percent(opts_.calls)) {
+			call(depth);
+		}
+		else if(r < 2 || ints_.empty()) {
+			printf("%u", random(100));
+		}
+		else if(r < 3 && opts_.scalars > 0) {
+			printf("g%u", random(opts_.scalars));
+		}
+		else if(r < 5 && opts_.arrays > 0) {
+			printf("a%u[", random(opts_.arrays));
+			index();
+			putchar(']');
+		}
+		else if(r < 7 && !counters_.empty()) {
+			printf("%s", counters_[random(counters_.size())].c_str());
+		}
+		else {
+			printf("%s", ints_[random(ints_.size())].c_str());
+		}
+		return;
+	}
+	switch(random(8)) {
+		case 0:
+			printf("(-");
+			expr(depth - 1);
+			putchar(')');
+			return;
+		case 1:
+			// Division and remainder by a literal, never by zero
+			putchar('(');
+			expr(depth - 1);
+			printf(random(2) ? " / %u)" : " %% %u)", 1 + random(9));
+			return;
+		default: {
+			static const char *ops[] = { "+", "-", "*", "+", "-", "+" };
+			putchar('(');
+			expr(depth - 1);
+			printf(" %s ", ops[random(6)]);
+			expr(depth - 1);
+			putchar(')');
+			return;
+		}
+	}
+}
+
+/* A boolean expression */
+void Generator::condition(int depth) {
+	static const char *cmp[] = { "<", "<=", ">", ">=", "==", "!=" };
+	if(depth > 1 && random(4) == 0) {
+		putchar('(');
+		condition(depth - 1);
+		printf(random(2) ? " && " : " || ");
+		condition(depth - 1);
+		putchar(')');
+		return;
+	}
+	if(depth > 1 && random(8) == 0) {
+		printf("(!");
+		condition(depth - 1);
+		putchar(')');
+		return;
+	}
+	putchar('(');
+	expr(depth > 0 ? depth - 1 : 0);
+	printf(" %s ", cmp[random(6)]);
+	expr(depth > 0 ? depth - 1 : 0);
+	putchar(')');
+}
+
+void Generator::statement(int nesting) {
+	if(percent(opts_.callouts)) {
+		begin();
+		printf("callout(\"printf\", \"%%d %%d\\n\", ");
+		expr(opts_.depth);
+		printf(", ");
+		expr(opts_.depth);
+		printf(");\n");
+		lines_++;
+		return;
+	}
+	unsigned r = random(20);
+	if(nesting > 0 && r < 3) {
+		begin();
+		printf("if(");
+		condition(opts_.depth);
+		printf(") {\n");
+		lines_++;
+		indent_++;
+		block(2 + random(3), nesting - 1);
+		indent_--;
+		if(random(2)) {
+			line("}");
+			line("else {");
+			indent_++;
+			block(1 + random(3), nesting - 1);
+			indent_--;
+		}
+		line("}");
+	}
+	else if(nesting > 0 && r < 5) {
+		string counter = "i" + to_string(counters_.size());
+		begin();
+		printf("for %s = 0, (%s < %d) {\n", counter.c_str(), counter.c_str(), opts_.trip);
+		lines_++;
+		indent_++;
+		counters_.push_back(counter);
+		block(2 + random(4), nesting - 1);
+		if(random(8) == 0) {
+			begin();
+			printf("if(");
+			condition(1);
+			printf(") {\n");
+			lines_++;
+			line("\t%s;", random(2) ? "break" : "continue");
+			line("}");
+		}
+		counters_.pop_back();
+		indent_--;
+		line("}");
+	}
+	else if(opts_.methods > 0 && r < 6) {
+		begin();
+		call(opts_.depth);
+		printf(";\n");
+		lines_++;
+	}
+	else {
+		static const char *assign[] = { "=", "=", "+=", "-=" };
+		begin();
+		unsigned target = random(4);
+		if(target == 0 && opts_.arrays > 0) {
+			printf("a%u[", random(opts_.arrays));
+			index();
+			putchar(']');
+		}
+		else if(target == 1 && opts_.scalars > 0) {
+			printf("g%u", random(opts_.scalars));
+		}
+		else {
+			printf("%s", ints_[random(ints_.size())].c_str());
+		}
+		printf(" %s ", assign[random(4)]);
+		expr(opts_.depth);
+		printf(";\n");
+		lines_++;
+	}
+}
+
+/* The statements of a block, which may start with a local of its own */
+void Generator::block(int statements, int nesting) {
+	size_t scope = ints_.size();
+	if(indent_ > 2 && random(4) == 0) {
+		string local = "t" + to_string(indent_);
+		line("int %s;", local.c_str());
+		begin();
+		printf("%s = ", local.c_str());
+		expr(1);
+		printf(";\n");
+		lines_++;
+		ints_.push_back(local);
+	}
+	for(int i = 0; i < statements; i++) {
+		statement(nesting);
+	}
+	ints_.resize(scope);
+}
+
+void Generator::method(int index) {
+	begin();
+	printf("int m%d(int fuel", index);
+	for(int i = 0; i < arity_[index]; i++) {
+		printf(", int p%d", i);
+	}
+	printf(") {\n");
+	lines_++;
+	indent_++;
+	line("int l0, l1, l2, l3;");
+	line("if(fuel <= 0) {");
+	line("\treturn 0;");
+	line("}");
+	ints_.clear();
+	for(int i = 0; i < arity_[index]; i++) {
+		ints_.push_back("p" + to_string(i));
+	}
+	for(int i = 0; i < 4; i++) {
+		begin();
+		printf("l%d = ", i);
+		expr(1);
+		printf(";\n");
+		lines_++;
+		ints_.push_back("l" + to_string(i));
+	}
+	block(opts_.statements, opts_.nesting);
+	begin();
+	printf("return ");
+	expr(opts_.depth);
+	printf(";\n");
+	lines_++;
+	indent_--;
+	line("}");
+}
+
+void Generator::program() {
+	for(int i = 0; i < opts_.methods; i++) {
+		arity_.push_back(random(4));
+	}
+	line("class Program {");
+	indent_++;
+	for(int i = 0; i < opts_.scalars; i++) {
+		line("int g%d;", i);
+	}
+	for(int i = 0; i < opts_.arrays; i++) {
+		line("int a%d[%d];", i, ArraySize);
+	}
+	for(int i = 0; i < opts_.methods; i++) {
+		method(i);
+	}
+
+	line("int main() {");
+	indent_++;
+	line("int fuel, l0;");
+	line("fuel = 3;");
+	line("l0 = 0;");
+	ints_.assign(1, "l0");
+	for(int i = 0; i < opts_.methods && i < 10; i++) {
+		begin();
+		printf("l0 += ");
+		call(1);
+		printf(";\n");
+		lines_++;
+	}
+	line("callout(\"printf\", \"%%d\\n\", l0);");
+	line("return 0;");
+	indent_--;
+	line("}");
+	indent_--;
+	line("}");
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [--methods=n] [--statements=n] [--depth=n] [--nesting=n] [--arrays=n]\n"
+					"       [--scalars=n] [--callouts=percent] [--calls=percent] [--trip=n] [--seed=n]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	GenOptions opts = { 100, 20, 3, 2, 4, 8, 10, 5, 8, 1 };
+	struct { const char *name; int *value; } options[] = {
+		{ "--methods=", &opts.methods }, { "--statements=", &opts.statements },
+		{ "--depth=", &opts.depth }, { "--nesting=", &opts.nesting },
+		{ "--arrays=", &opts.arrays }, { "--scalars=", &opts.scalars },
+		{ "--callouts=", &opts.callouts }, { "--calls=", &opts.calls },
+		{ "--trip=", &opts.trip },
+	};
+	for(int i = 1; i < argc; i++) {
+		bool known = false;
+		for(unsigned o = 0; o < sizeof(options) / sizeof(options[0]); o++) {
+			size_t len = strlen(options[o].name);
+			if(strncmp(argv[i], options[o].name, len) == 0) {
+				*options[o].value = atoi(argv[i] + len);
+				known = true;
+			}
+		}
+		if(strncmp(argv[i], "--seed=", 7) == 0) {
+			opts.seed = strtoul(argv[i] + 7, nullptr, 10);
+			known = true;
+		}
+		if(!known) {
+			usage(argv[0]);
+		}
+	}
+	if(opts.methods < 0 || opts.statements < 0 || opts.depth < 0 || opts.nesting < 0 ||
+	   opts.arrays < 0 || opts.scalars < 0 || opts.trip < 1 || opts.trip >= ArraySize) {
+		usage(argv[0]);
+	}
+
+	Generator gen(opts);
+	gen.program();
+	fprintf(stderr, "%d lines, %d methods\n", gen.getLines(), opts.methods + 1);
+	return 0;
+}
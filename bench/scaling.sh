@@ -0,0 +1,37 @@
+#!/bin/sh
+# Compile-time scaling of decaf. Generates synthetic programs with
+# bench/gen_decaf, growing one dimension at a time, and times every phase
+# of compiling them with bench/compile_phases.
+#
+# Usage : bench/scaling.sh [-O0|-O1|-O2|-O3] [-j jobs]
+# Run from the top of the tree after make bench.
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/decaf-scaling.XXXXXX") || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+run() {
+	name=$1
+	shift
+	bench/gen_decaf "$@" > "$dir/$name" 2>/dev/null || exit 1
+	echo "== $name : $*"
+	bench/compile_phases $OPTS "$dir/$name" | tail -n +2
+}
+
+OPTS="$*"
+
+for m in 10 100 1000 10000; do
+	run methods-$m --methods=$m
+done
+for s in 10 100 1000; do
+	run statements-$s --methods=100 --statements=$s
+done
+for d in 2 4 8; do
+	run depth-$d --methods=100 --depth=$d
+done
+for n in 1 3 5; do
+	run nesting-$n --methods=100 --nesting=$n
+done
+for c in 0 50 100; do
+	run callouts-$c --methods=100 --callouts=$c
+done
+run arrays-1000 --methods=100 --arrays=1000
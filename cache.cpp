@@ -0,0 +1,262 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "include/cache.h"
+#include "include/stdllvm.h"
+using namespace std;
+using namespace llvm;
+
+/* Bump when the layout of the cache or the meaning of a key changes */
+static const char *CacheFormat = "decaf-cache-1";
+
+/* Entries are evicted down to this fraction of the limit, so that eviction is not run on every store */
+static const double EvictTo = 0.9;
+
+/* Holds the cache's lock file locked for its lifetime */
+class CacheLock {
+	public:
+		CacheLock(const string &path) {
+			fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+			if(fd_ >= 0) {
+				flock(fd_, LOCK_EX);
+			}
+		}
+		~CacheLock() {
+			if(fd_ >= 0) {
+				flock(fd_, LOCK_UN);
+				close(fd_);
+			}
+		}
+
+	private:
+		int fd_;
+};
+
+static int dummyForExecutablePath;
+
+static bool readFile(const string &path, string &data) {
+	ifstream in(path.c_str(), ios::binary);
+	if(!in) {
+		return false;
+	}
+	ostringstream s;
+	s << in.rdbuf();
+	data = s.str();
+	return true;
+}
+
+CompileCache::CompileCache(const string &dir, uint64_t maxBytes) : dir_(dir), maxBytes_(maxBytes), pending_() {
+	sys::fs::create_directories(dir_ + "/objects");
+
+	// A rebuilt compiler may generate different code, so its size and time stamp are part of every key
+	compiler_ = string(CacheFormat) + " LLVM " + LLVM_VERSION_STRING;
+	string exe = sys::fs::getMainExecutable("decaf", &dummyForExecutablePath);
+	struct stat st;
+	if(!exe.empty() && stat(exe.c_str(), &st) == 0) {
+		compiler_ += " " + to_string((unsigned long long)st.st_size) + " " + to_string((long long)st.st_mtime);
+	}
+}
+
+string CompileCache::defaultDirectory() {
+	const char *dir = getenv("DECAF_CACHE_DIR");
+	if(dir && *dir) {
+		return dir;
+	}
+	dir = getenv("XDG_CACHE_HOME");
+	if(dir && *dir) {
+		return string(dir) + "/decaf";
+	}
+	dir = getenv("HOME");
+	return string(dir ? dir : "/tmp") + "/.cache/decaf";
+}
+
+string CompileCache::computeKey(const string &source, const string &flags) const {
+	MD5 hash;
+	hash.update(compiler_);
+	hash.update(StringRef("\0", 1));
+	hash.update(flags);
+	hash.update(StringRef("\0", 1));
+	hash.update(source);
+	MD5::MD5Result result;
+	hash.final(result);
+	SmallString<32> hex;
+	MD5::stringifyResult(result, hex);
+	return hex.str().str();
+}
+
+/* objects/ab/abcdef... : the first byte of the key spreads the entries over 256 directories */
+string CompileCache::entryPath(const string &key) const {
+	return dir_ + "/objects/" + key.substr(0, 2) + "/" + key;
+}
+
+/* Adds delta to the statistics file and returns the new totals */
+CompileCache::Stats CompileCache::updateStats(const Stats &delta) {
+	CacheLock lock(dir_ + "/lock");
+	Stats s = { 0, 0, 0, 0, 0 };
+	string path = dir_ + "/stats";
+	ifstream in(path.c_str());
+	string name;
+	uint64_t value;
+	while(in >> name >> value) {
+		if(name == "hits") s.hits = value;
+		else if(name == "misses") s.misses = value;
+		else if(name == "stores") s.stores = value;
+		else if(name == "evictions") s.evictions = value;
+		else if(name == "bytes") s.bytes = value;
+	}
+	in.close();
+	s.hits += delta.hits;
+	s.misses += delta.misses;
+	s.stores += delta.stores;
+	s.evictions += delta.evictions;
+	s.bytes += delta.bytes;
+	if(s.bytes > maxBytes_) {
+		s.evictions += evict(&s.bytes);
+	}
+	ofstream out(path.c_str(), ios::trunc);
+	out << "hits " << s.hits << "\nmisses " << s.misses << "\nstores " << s.stores
+		<< "\nevictions " << s.evictions << "\nbytes " << s.bytes << "\n";
+	return s;
+}
+
+/*
+ * Removes the least recently used entries until the cache is below its
+ * limit, and recounts its size : the running count in the statistics can
+ * drift when two compiles store the same entry. Called with the lock held.
+ * Returns the number of entries removed.
+ */
+uint64_t CompileCache::evict(uint64_t *bytes) {
+	struct Entry {
+		string path;
+		time_t used;
+		uint64_t size;
+		bool operator<(const Entry &e) const {
+			return used < e.used;
+		}
+	};
+	vector<Entry> entries;
+	uint64_t total = 0;
+	error_code ec;
+	for(sys::fs::recursive_directory_iterator it(dir_ + "/objects", ec), end; it != end && !ec; it.increment(ec)) {
+		struct stat st;
+		if(stat(it->path().c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+			Entry e = { it->path(), st.st_mtime, (uint64_t)st.st_size };
+			entries.push_back(e);
+			total += e.size;
+		}
+	}
+	std::sort(entries.begin(), entries.end());
+
+	uint64_t removed = 0;
+	for(unsigned i = 0; i < entries.size() && total > maxBytes_ * EvictTo; i++) {
+		if(unlink(entries[i].path.c_str()) == 0) {
+			total -= entries[i].size;
+			removed++;
+		}
+	}
+	*bytes = total;
+	return removed;
+}
+
+bool CompileCache::lookupBlob(const string &key, string &data) {
+	string entry = entryPath(key);
+	bool hit = readFile(entry, data);
+	if(hit) {
+		utime(entry.c_str(), nullptr);			// Most recently used
+	}
+	lock_guard<mutex> guard(lock_);
+	if(hit) {
+		pending_.hits++;
+	}
+	else {
+		pending_.misses++;
+	}
+	return hit;
+}
+
+void CompileCache::storeBlob(const string &key, StringRef data) {
+	string entry = entryPath(key);
+	sys::fs::create_directories(dir_ + "/objects/" + key.substr(0, 2));
+
+	// Readers only ever see complete entries : write aside, then rename into place
+	int fd;
+	SmallString<128> tmp;
+	if(sys::fs::createUniqueFile(entry + ".tmp-%%%%%%%%", fd, tmp)) {
+		return;
+	}
+	bool ok;
+	{
+		raw_fd_ostream out(fd, true);
+		out << data;
+		out.flush();
+		ok = !out.has_error();
+		out.clear_error();
+	}
+	if(!ok || rename(tmp.c_str(), entry.c_str()) != 0) {
+		unlink(tmp.c_str());
+		return;
+	}
+	lock_guard<mutex> guard(lock_);
+	pending_.stores++;
+	pending_.bytes += data.size();
+}
+
+bool CompileCache::lookup(const string &key, const string &output) {
+	string data;
+	if(!lookupBlob(key, data)) {
+		return false;
+	}
+	ofstream out(output.c_str(), ios::binary | ios::trunc);
+	if(!out.write(data.data(), data.size()) || !out.flush()) {
+		out.close();
+		unlink(output.c_str());
+		return false;
+	}
+	return true;
+}
+
+void CompileCache::store(const string &key, const string &output) {
+	string data;
+	if(readFile(output, data)) {
+		storeBlob(key, data);
+	}
+}
+
+void CompileCache::flushStats() {
+	flushPending();
+}
+
+CompileCache::Stats CompileCache::flushPending() {
+	Stats delta;
+	{
+		lock_guard<mutex> guard(lock_);
+		delta = pending_;
+		pending_ = Stats();
+	}
+	return updateStats(delta);
+}
+
+void CompileCache::printStats(ostream &os) {
+	Stats s = flushPending();
+	uint64_t lookups = s.hits + s.misses;
+	os << "cache directory : " << dir_ << "\n";
+	os << "size            : " << s.bytes / 1024 << " KB of " << maxBytes_ / 1024 << " KB\n";
+	os << "hits            : " << s.hits << "\n";
+	os << "misses          : " << s.misses << "\n";
+	if(lookups) {
+		os << "hit rate        : " << (100.0 * s.hits / lookups) << " %\n";
+	}
+	os << "stores          : " << s.stores << "\n";
+	os << "evictions       : " << s.evictions << "\n";
+}
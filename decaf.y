@@ -1,17 +1,21 @@
 %{
 #include "include/head.h"           // Include some C++ headers
 #include "include/ast.h"            // AST's interfaces
-int yyerror(string s);
-int yylex(void);
+#include "include/session.h"        // Arena the AST is allocated from
+#include "include/parser.h"         // State of the parse
+#include "include/builtins.h"       // Array builtins
 using namespace std;
-
-ASTProgramNode *root;
 %}
 
+%define api.pure
+%parse-param        { void *scanner }
+%lex-param          { void *scanner }
+
 %union
 {
     int     intVal;
-    string  *strVal;
+    const char *strVal;
+    Ident   ident;
 
     ASTProgramNode* prog;
     ASTStatementDeclNode* stmt;
@@ -19,26 +23,39 @@ ASTProgramNode *root;
     ASTMethodDeclNode *method;
     ASTBlock *bl;
     ASTParameterDecl *param;
-    list<ASTParameterDecl *> *paramList;
-    list<ASTMethodDeclNode *> *methList;
-    list<ASTStatementDeclNode*> *stmtlist;
+    ASTFieldDecl *field;
+    ListBuilder *list;
     Symbol* sym;
-    list<Symbol*> *symlist;
     ASTIntegerLiteralExpressionNode* intLit;
     ASTLocationNode* loc;
     ASTExpressionNode* expr;
-    list<ASTExpressionNode *> *exprList;
     ASTBinaryExpressionNode* binexpr;
-    list<ASTCalloutArg *> *carglist;
     ASTCalloutArg* carg;
 }
 
+%{
+int yylex(YYSTYPE *lvalp, void *scanner);
+void yyerror(void *scanner, const char *s);
+
+/* Defined by the reentrant scanner in lex.c */
+int yylex_init_extra(ParseState *state, void **scanner);
+void yyset_in(FILE *in, void *scanner);
+int yylex_destroy(void *scanner);
+ParseState *yyget_extra(void *scanner);
+char *yyget_text(void *scanner);
+int yyget_lineno(void *scanner);
+
+void checkParallelFor(void *scanner, ASTForStatementDeclNode *node);
+void checkBuiltinCall(void *scanner, ASTSimpleMethodCallNode *node);
+void checkMethodName(void *scanner, Ident name);
+%}
+
 
 %start              Program
 
 %token              CHAR_LITERAL STRING_LITERAL TYPES BOOL_LITERAL
 %token              ID DEC_LITERAL HEX_LITERAL INTEGER BOOLEAN
-%token              HEADER CALLOUT VOID IF ELSE CONTINUE BREAK RETURN FOR
+%token              HEADER CALLOUT VOID IF ELSE CONTINUE BREAK RETURN FOR PARALLEL
 %token              AND OR MINUS PLUS MULT DIV MOD
 %token              ASSIGN PLUSASSIGN MINUSASSIGN
 %token              EQ GT LT GTEQ LTEQ NEQ BING UNARY
@@ -50,194 +67,320 @@ ASTProgramNode *root;
 %left               BING
 %left               UNARY
 
-%type               <strVal>                            ID
-%type               <strVal>                            TYPES
+%type               <ident>                             ID
+%type               <intVal>                            TYPES
 %type               <intVal>                            DEC_LITERAL
 %type               <intVal>                            HEX_LITERAL
 %type               <strVal>                            STRING_LITERAL
-%type               <strVal>                            ASSIGN
-%type               <strVal>                            PLUSASSIGN
-%type               <strVal>                            MINUSASSIGN
-%type               <strVal>                            CHAR_LITERAL
-%type               <strVal>                            BOOL_LITERAL
-%type               <strVal>                            MINUS
-%type               <strVal>                            BING
-%type               <strVal>                            MULT
-%type               <strVal>                            DIV
-%type               <strVal>                            PLUS
-%type               <strVal>                            MOD
-%type               <strVal>                            AND
-%type               <strVal>                            OR
-%type               <strVal>                            EQ
-%type               <strVal>                            NEQ
-%type               <strVal>                            GT
-%type               <strVal>                            LT
-%type               <strVal>                            GTEQ
-%type               <strVal>                            LTEQ
+%type               <intVal>                            CHAR_LITERAL
+%type               <intVal>                            BOOL_LITERAL
 
 %type               <prog>                              Program
 %type               <stmt>                              StatementDecl
-%type               <stmtlist>                          StatementDeclList
-%type               <symlist>                           VariableList
+%type               <list>                              StatementDeclList
+%type               <field>                             FieldDecl
+%type               <list>                              FieldDeclList
+%type               <list>                              VariableList
 %type               <sym>                               Variable
 %type               <intVal>                            Type
 %type               <intLit>                            IntegerLiteral
-%type               <strVal>                            AssignOp
+%type               <intVal>                            AssignOp
 %type               <loc>                               Location
 %type               <expr>                              Expr
 %type               <binexpr>                           BinaryExpr
-%type               <carglist>                          CalloutArgList
+%type               <list>                              CalloutArgList
 %type               <carg>                              CalloutArg
 %type               <method>                            MethodDecl
-%type               <methList>                          MethodDeclList
-%type               <methList>                          nonEmptyMethodDeclList
+%type               <list>                              MethodDeclList
+%type               <list>                              nonEmptyMethodDeclList
 %type               <meth1>                             MethodCall
 %type               <bl>                                Block
 %type               <param>                             ParameterDecl
-%type               <paramList>                         ParameterDeclList
-%type               <paramList>                         nonEmptyParameterDeclList
-%type               <exprList>                          ExprList
-%type               <exprList>                          nonEmptyExprList
+%type               <list>                              ParameterDeclList
+%type               <list>                              nonEmptyParameterDeclList
+%type               <list>                              ExprList
+%type               <list>                              nonEmptyExprList
 
 %%
 
 /* Grammar for the Decaf Programming Language */
 
-Program:            HEADER '{' FieldDeclList MethodDeclList '}' { $$ = new ASTProgramNode($4); root = $$; BuildIR(root); }
+Program:            HEADER '{' FieldDeclList MethodDeclList '}' { $$ = Session->make<ASTProgramNode>(Session->finishList<ASTFieldDecl>($3), Session->finishList<ASTMethodDeclNode>($4)); yyget_extra(scanner)->root = $$; }
                     ;
 
-MethodDecl:         Type ID '(' ParameterDeclList ')' Block { $$ = new ASTMethodDeclNode($1, *($2), $4, $6); }
-                    | VOID ID '(' ParameterDeclList ')' Block { $$ = new ASTMethodDeclNode(3, *($2), $4, $6); }
+MethodDecl:         Type ID '(' ParameterDeclList ')' Block { checkMethodName(scanner, $2); $$ = Session->make<ASTMethodDeclNode>($1, $2, Session->finishList<ASTParameterDecl>($4), $6); }
+                    | VOID ID '(' ParameterDeclList ')' Block { checkMethodName(scanner, $2); $$ = Session->make<ASTMethodDeclNode>(_void_, $2, Session->finishList<ASTParameterDecl>($4), $6); }
                     ;
 
-MethodDeclList:     /* empty */ { $$ = new list<ASTMethodDeclNode *>(); }
+MethodDeclList:     /* empty */ { $$ = Session->newListBuilder(); }
                     | nonEmptyMethodDeclList { $$ = $1; }
                     ;
 
-nonEmptyMethodDeclList: MethodDecl { $$ = new list<ASTMethodDeclNode *>(); $$->push_back($1); }
+nonEmptyMethodDeclList: MethodDecl { $$ = Session->newListBuilder(); $$->push_back($1); }
                         | nonEmptyMethodDeclList MethodDecl { $$ = $1; $$->push_back($2); }
                         ;
 
-FieldDeclList:      /* empty */
-                    | FieldDeclList FieldDecl
+FieldDeclList:      /* empty */ { $$ = Session->newListBuilder(); }
+                    | FieldDeclList FieldDecl { $$ = $1; $$->push_back($2); }
                     ;
 
-StatementDeclList:  /* empty */ { $$ = new list<ASTStatementDeclNode *>(); }
+StatementDeclList:  /* empty */ { $$ = Session->newListBuilder(); }
                     | StatementDeclList StatementDecl { $$ = $1; $$->push_back($2); }
                     ;
 
-FieldDecl:          Type VariableList ';' { annotateSymbolTable($1, $2); }
+FieldDecl:          Type VariableList ';' { $$ = Session->make<ASTFieldDecl>($1, Session->finishList<Symbol>($2)); }
                     ;
 
-VariableList:       Variable { $$ = new list<Symbol *>(); $$->push_back($1); }
+VariableList:       Variable { $$ = Session->newListBuilder(); $$->push_back($1); }
                     | VariableList ',' Variable { $$ = $1; $$->push_back($3); }
                     ;
 
-Variable:           ID { $$ = new Symbol(*($1)); }
-                    | ID '[' IntegerLiteral ']' { $$ = new Symbol(*($1), $3); }
+Variable:           ID { $$ = Session->make<Symbol>($1); }
+                    | ID '[' IntegerLiteral ']' { $$ = Session->make<Symbol>($1, $3); }
                     ;
 
-Type:               TYPES { if(!($1->compare("int"))) $$ = _int_; else $$ = _bool_; }
+Type:               TYPES { $$ = $1; }
                     ;
 
-IntegerLiteral:     DEC_LITERAL { $$ = new ASTIntegerLiteralExpressionNode($1); }
-                    | HEX_LITERAL { $$ = new ASTIntegerLiteralExpressionNode($1); }
+IntegerLiteral:     DEC_LITERAL { $$ = Session->make<ASTIntegerLiteralExpressionNode>($1); }
+                    | HEX_LITERAL { $$ = Session->make<ASTIntegerLiteralExpressionNode>($1); }
                     ;
 
-StatementDecl:      Location AssignOp Expr ';' { $$ = new ASTAssignmentStatementNode($1, *($2), $3); }
+StatementDecl:      Location AssignOp Expr ';' { $$ = Session->make<ASTAssignmentStatementNode>($1, $2, $3); }
                     | MethodCall ';' { $$ = $1; }
-                    | IF '(' Expr ')' Block { $$ = new ASTIfStatementDeclNode($3, $5, nullptr); }
-                    | IF '(' Expr ')' Block ELSE Block { $$ = new ASTIfStatementDeclNode($3, $5, $7); }
-                    | FOR ID AssignOp Expr ',' Expr Block { $$ = new ASTForStatementDeclNode(*($2), $4, $6, $7); }
-                    | RETURN Expr ';' { $$ = new ASTReturnStatementNode($2); }
-                    | BREAK ';' { $$ = new ASTBreakStatementNode(); }
-                    | CONTINUE ';' { $$ = new ASTContinueStatementNode(); }
-                    | Block { $$ = new ASTBlockStatementNode($1); }
+                    | IF '(' Expr ')' Block { $$ = Session->make<ASTIfStatementDeclNode>($3, $5, nullptr); }
+                    | IF '(' Expr ')' Block ELSE Block { $$ = Session->make<ASTIfStatementDeclNode>($3, $5, $7); }
+                    | FOR ID AssignOp Expr ',' Expr Block { $$ = Session->make<ASTForStatementDeclNode>($2, $4, $6, $7); }
+                    | PARALLEL FOR ID AssignOp Expr ',' Expr Block { ASTForStatementDeclNode *f = Session->make<ASTForStatementDeclNode>($3, $5, $7, $8, true); checkParallelFor(scanner, f); $$ = f; }
+                    | RETURN Expr ';' { $$ = Session->make<ASTReturnStatementNode>($2); }
+                    | BREAK ';' { $$ = Session->make<ASTBreakStatementNode>(); }
+                    | CONTINUE ';' { $$ = Session->make<ASTContinueStatementNode>(); }
+                    | Block { $$ = Session->make<ASTBlockStatementNode>($1); }
                     ;
 
-MethodCall:         ID '(' ExprList ')' { $$ = new ASTSimpleMethodCallNode(*($1), $3); }
-                    | CALLOUT '(' STRING_LITERAL ',' CalloutArgList ')' { $$ = new ASTCalloutMethodCallNode(*($3), $5); }
+MethodCall:         ID '(' ExprList ')' { ASTSimpleMethodCallNode *c = Session->make<ASTSimpleMethodCallNode>($1, Session->finishList<ASTExpressionNode>($3)); checkBuiltinCall(scanner, c); $$ = c; }
+                    | CALLOUT '(' STRING_LITERAL ',' CalloutArgList ')' { $$ = Session->make<ASTCalloutMethodCallNode>($3, Session->finishList<ASTCalloutArg>($5)); }
                     ;
 
-ParameterDeclList:  /* empty */ { $$ = new list<ASTParameterDecl *>(); }
+ParameterDeclList:  /* empty */ { $$ = Session->newListBuilder(); }
                     | nonEmptyParameterDeclList { $$ = $1; }
                     ;
 
-nonEmptyParameterDeclList: ParameterDecl { $$ = new list<ASTParameterDecl *>(); $$->push_back($1); }
+nonEmptyParameterDeclList: ParameterDecl { $$ = Session->newListBuilder(); $$->push_back($1); }
                         | nonEmptyParameterDeclList ',' ParameterDecl { $$ = $1; $$->push_back($3); }
                         ;
 
-ParameterDecl:      Type ID { $$ = new ASTParameterDecl($1, *($2), false); }
-                    | Type ID '[' ']' { $$ = new ASTParameterDecl($1, *($2), true); }
+ParameterDecl:      Type ID { $$ = Session->make<ASTParameterDecl>($1, $2, false); }
+                    | Type ID '[' ']' { $$ = Session->make<ASTParameterDecl>($1, $2, true); }
                     ;
 
-Block:              '{' FieldDeclList StatementDeclList '}' { $$ = new ASTBlock($3); }
+Block:              '{' FieldDeclList StatementDeclList '}' { $$ = Session->make<ASTBlock>(Session->finishList<ASTFieldDecl>($2), Session->finishList<ASTStatementDeclNode>($3)); }
                     ;
 
-AssignOp:           ASSIGN { $$ = $1; }
-                    | PLUSASSIGN { $$ = $1; }
-                    | MINUSASSIGN { $$ = $1; }
+AssignOp:           ASSIGN { $$ = _assign; }
+                    | PLUSASSIGN { $$ = _plusassign; }
+                    | MINUSASSIGN { $$ = _minusassign; }
                     ;
 
-Location:           ID { $$ = new ASTVarLocationNode(*($1)); }
-                    | ID '[' Expr ']' { $$ = new ASTArrayLocationNode(*($1), $3); }
+Location:           ID { $$ = Session->make<ASTVarLocationNode>($1); }
+                    | ID '[' Expr ']' { $$ = Session->make<ASTArrayLocationNode>($1, $3); }
                     ;
 
-ExprList:           /* empty */ { $$ = new list<ASTExpressionNode *>(); }
+ExprList:           /* empty */ { $$ = Session->newListBuilder(); }
                     | nonEmptyExprList { $$ = $1; }
                     ;
 
-nonEmptyExprList:   Expr { $$ = new list<ASTExpressionNode *>(); $$->push_back($1); }
+nonEmptyExprList:   Expr { $$ = Session->newListBuilder(); $$->push_back($1); }
                     | nonEmptyExprList ',' Expr { $$ = $1; $$->push_back($3); }
                     ;
 
-Expr:               Location { $$ = new ASTLocationExpressionNode($1); }
-                    | MethodCall { $$ = new ASTMethodCallExpressionNode($1); }
+Expr:               Location { $$ = Session->make<ASTLocationExpressionNode>($1); }
+                    | MethodCall { $$ = Session->make<ASTMethodCallExpressionNode>($1); }
                     | IntegerLiteral { $$ = $1; }
-                    | MINUS Expr %prec UNARY { $$ = new ASTUnaryExpressionNode($2, *($1)); }
-                    | BING Expr { $$ = new ASTUnaryExpressionNode($2, *($1)); }
-                    | CHAR_LITERAL { $$ = new ASTCharLiteralExpressionNode((*$1)[0]); }
-                    | BOOL_LITERAL { $$ = new ASTBoolLiteralExpressionNode(*($1)); }
+                    | MINUS Expr %prec UNARY { $$ = Session->make<ASTUnaryExpressionNode>($2, _unaryminus); }
+                    | BING Expr { $$ = Session->make<ASTUnaryExpressionNode>($2, _negate); }
+                    | CHAR_LITERAL { $$ = Session->make<ASTCharLiteralExpressionNode>($1); }
+                    | BOOL_LITERAL { $$ = Session->make<ASTBoolLiteralExpressionNode>($1 != 0); }
                     | '(' Expr ')' { $$ = $2; }
                     | BinaryExpr { $$ = $1; }
                     ;
 
-BinaryExpr:         Expr MULT Expr { $$ = new ASTBinaryExpressionNode($1, $3, *($2)); }
-                    | Expr DIV Expr { $$ = new ASTBinaryExpressionNode($1, $3, *($2)); }
-                    | Expr PLUS Expr { $$ = new ASTBinaryExpressionNode($1, $3, *($2)); }
-                    | Expr MINUS Expr { $$ = new ASTBinaryExpressionNode($1, $3, *($2)); }
-                    | Expr MOD Expr { $$ = new ASTBinaryExpressionNode($1, $3, *($2)); }
-                    | Expr AND Expr { $$ = new ASTBinaryExpressionNode($1, $3, *($2)); }
-                    | Expr OR Expr { $$ = new ASTBinaryExpressionNode($1, $3, *($2)); }
-                    | Expr EQ Expr { $$ = new ASTBinaryExpressionNode($1, $3, *($2)); }
-                    | Expr NEQ Expr { $$ = new ASTBinaryExpressionNode($1, $3, *($2)); }
-                    | Expr GT Expr { $$ = new ASTBinaryExpressionNode($1, $3, *($2)); }
-                    | Expr LT Expr { $$ = new ASTBinaryExpressionNode($1, $3, *($2)); }
-                    | Expr GTEQ Expr { $$ = new ASTBinaryExpressionNode($1, $3, *($2)); }
-                    | Expr LTEQ Expr { $$ = new ASTBinaryExpressionNode($1, $3, *($2)); }
+BinaryExpr:         Expr MULT Expr { $$ = Session->make<ASTBinaryExpressionNode>($1, $3, _mult); }
+                    | Expr DIV Expr { $$ = Session->make<ASTBinaryExpressionNode>($1, $3, _div); }
+                    | Expr PLUS Expr { $$ = Session->make<ASTBinaryExpressionNode>($1, $3, _plus); }
+                    | Expr MINUS Expr { $$ = Session->make<ASTBinaryExpressionNode>($1, $3, _minus); }
+                    | Expr MOD Expr { $$ = Session->make<ASTBinaryExpressionNode>($1, $3, _mod); }
+                    | Expr AND Expr { $$ = Session->make<ASTBinaryExpressionNode>($1, $3, _and); }
+                    | Expr OR Expr { $$ = Session->make<ASTBinaryExpressionNode>($1, $3, _or); }
+                    | Expr EQ Expr { $$ = Session->make<ASTBinaryExpressionNode>($1, $3, _eq); }
+                    | Expr NEQ Expr { $$ = Session->make<ASTBinaryExpressionNode>($1, $3, _neq); }
+                    | Expr GT Expr { $$ = Session->make<ASTBinaryExpressionNode>($1, $3, _gt); }
+                    | Expr LT Expr { $$ = Session->make<ASTBinaryExpressionNode>($1, $3, _lt); }
+                    | Expr GTEQ Expr { $$ = Session->make<ASTBinaryExpressionNode>($1, $3, _gteq); }
+                    | Expr LTEQ Expr { $$ = Session->make<ASTBinaryExpressionNode>($1, $3, _lteq); }
                     ;
 
-CalloutArgList:     CalloutArg { $$ = new list<ASTCalloutArg *>(); $$->push_back($1); }
+CalloutArgList:     CalloutArg { $$ = Session->newListBuilder(); $$->push_back($1); }
                     | CalloutArgList ',' CalloutArg { $$ = $1; $$->push_back($3); }
                     ;
 
-CalloutArg:         Expr { $$ = new ASTExpressionCalloutArg($1); }
-                    | STRING_LITERAL { $$ = new ASTStringCalloutArg(*$1); }
+CalloutArg:         Expr { $$ = Session->make<ASTExpressionCalloutArg>($1); }
+                    | STRING_LITERAL { $$ = Session->make<ASTStringCalloutArg>($1); }
                     ;
 
 %%
 
-int yyerror(string s)
+void yyerror(void *scanner, const char *s)
+{
+    ParseState *state = yyget_extra(scanner);
+    state->errors++;
+    cerr << state->fileName << ": ERROR: " << s << " at symbol \"" << yyget_text(scanner);
+    cerr << "\" on line " << yyget_lineno(scanner) << endl;
+}
+
+/*
+ * Whether a block can leave the loop it is in other than by the end of an
+ * iteration : with a return, or with a break when it is not in a loop of
+ * its own.
+ */
+static bool leavesLoop(ASTBlock *block, bool breaks)
+{
+    const ASTArray<ASTStatementDeclNode *> &s = block->getStatementList();
+    for (ASTArray<ASTStatementDeclNode *>::iterator it = s.begin(); it != s.end(); it++) {
+        ASTStatementDeclNode *stmt = *it;
+        switch (stmt->getKind()) {
+            case AST_RETURN_STATEMENT:
+                return true;
+            case AST_BREAK_STATEMENT:
+                if (breaks)
+                    return true;
+                break;
+            case AST_BLOCK_STATEMENT:
+                if (leavesLoop(static_cast<ASTBlockStatementNode *>(stmt)->getBlock(), breaks))
+                    return true;
+                break;
+            case AST_IF_STATEMENT: {
+                ASTIfStatementDeclNode *node = static_cast<ASTIfStatementDeclNode *>(stmt);
+                if (leavesLoop(node->getIfBlock(), breaks) ||
+                    (node->getElseBlock() && leavesLoop(node->getElseBlock(), breaks)))
+                    return true;
+                break;
+            }
+            case AST_FOR_STATEMENT:
+                if (leavesLoop(static_cast<ASTForStatementDeclNode *>(stmt)->getForBody(), false))
+                    return true;
+                break;
+            default:
+                break;
+        }
+    }
+    return false;
+}
+
+static bool isIterator(ASTExpressionNode *e, Ident it)
 {
-    extern int yylineno;	// defined and maintained in lex.c
-    extern char *yytext;	// defined and maintained in lex.c
+    if (e->getKind() != AST_LOCATION_EXPRESSION)
+        return false;
+    ASTLocationNode *loc = static_cast<ASTLocationExpressionNode *>(e)->getLocation();
+    return loc->getKind() == AST_VAR_LOCATION && static_cast<ASTVarLocationNode *>(loc)->getVar() == it;
+}
+
+/*
+ * The iterations of a parallel for run in no particular order, on several
+ * threads, so the range they cover must be known before the first one :
+ * the condition bounds the iterator from above (i < e, i <= e, e > i or
+ * e >= i), and the body never leaves the loop early.
+ */
+void checkParallelFor(void *scanner, ASTForStatementDeclNode *node)
+{
+    ParseState *state = yyget_extra(scanner);
+    ASTExpressionNode *end = node->getFinalExpression();
+    Ident it = node->getIterVarName();
+    const char *error = NULL;
+    bool bounded = false;
+    if (end->getKind() == AST_BINARY_EXPRESSION) {
+        int op = static_cast<ASTBinaryExpressionNode *>(end)->getOperatorId();
+        bounded = ((op == _lt || op == _lteq) && isIterator(end->left, it)) ||
+                  ((op == _gt || op == _gteq) && isIterator(end->right, it));
+    }
+    if (!bounded)
+        error = "condition of parallel for must be <iterator> < <expr> or <iterator> <= <expr>";
+    else if (leavesLoop(node->getForBody(), true))
+        error = "break or return in the body of a parallel for";
+    if (error) {
+        state->errors++;
+        cerr << state->fileName << ": ERROR: " << error << " on line " << yyget_lineno(scanner) << endl;
+    }
+}
 
-    cout << "ERROR: " << s << " at symbol \"" << yytext;
-    cout << "\" on line " << yylineno << endl;
-    exit(1);
+/*
+ * A call to an array builtin must pass the names of arrays where it takes
+ * arrays; that they are arrays, of the right type, is left to the code
+ * generation, like the types of everything else.
+ */
+void checkBuiltinCall(void *scanner, ASTSimpleMethodCallNode *node)
+{
+    const Builtin *b = findBuiltin(Session->getName(node->getMethodName()));
+    if (!b)
+        return;
+    ParseState *state = yyget_extra(scanner);
+    const ASTArray<ASTExpressionNode *> &args = node->getExpressionList();
+    string error;
+    if (args.size() != b->args) {
+        error = string(b->name) + " takes " + to_string(b->args) + (b->args == 1 ? " argument" : " arguments");
+    }
+    for (unsigned i = 0; error.empty() && i < b->arrays; i++) {
+        ASTExpressionNode *e = args[i];
+        if (e->getKind() != AST_LOCATION_EXPRESSION ||
+            static_cast<ASTLocationExpressionNode *>(e)->getLocation()->getKind() != AST_VAR_LOCATION)
+            error = "argument " + to_string(i + 1) + " of " + b->name + " must name an array";
+    }
+    if (!error.empty()) {
+        state->errors++;
+        cerr << state->fileName << ": ERROR: " << error << " on line " << yyget_lineno(scanner) << endl;
+    }
+}
+
+void checkMethodName(void *scanner, Ident name)
+{
+    const Builtin *b = findBuiltin(Session->getName(name));
+    if (b) {
+        ParseState *state = yyget_extra(scanner);
+        state->errors++;
+        cerr << state->fileName << ": ERROR: method " << b->name << " is a builtin on line " << yyget_lineno(scanner) << endl;
+    }
+}
+
+ASTProgramNode *ParseProgram(FILE *in, const char *fileName)
+{
+    ParseState state;
+    state.fileName = fileName;
+    state.root = NULL;
+    state.errors = 0;
+
+    void *scanner;
+    if (yylex_init_extra(&state, &scanner))
+        return NULL;
+    yyset_in(in, scanner);
+    int failed = yyparse(scanner);
+    yylex_destroy(scanner);
+    return failed || state.errors ? NULL : state.root;
 }
 
-int yyerror(char *s)
+int ScanProgram(FILE *in, const char *fileName)
 {
-    return yyerror(string(s));
+    ParseState state;
+    state.fileName = fileName;
+    state.root = NULL;
+    state.errors = 0;
+    void *scanner;
+    if (yylex_init_extra(&state, &scanner))
+        return -1;
+    yyset_in(in, scanner);
+    YYSTYPE value;
+    int tokens = 0;
+    while (yylex(&value, scanner))
+        tokens++;
+    yylex_destroy(scanner);
+    return tokens;
 }
@@ -0,0 +1,271 @@
+#include "include/head.h"
+#include "include/stdllvm.h"
+#include "include/driver.h"
+#include "include/optimize.h"
+#include "include/emit.h"
+#include "include/jit.h"
+#include "include/session.h"
+#include "include/ast.h"
+#include "include/parser.h"
+#include "include/fold.h"
+#include "include/wholeprogram.h"
+#include "include/timing.h"
+#include "include/memreport.h"
+#include <chrono>
+#include <vector>
+using namespace llvm;
+
+const char *ProgName = "decaf";
+
+const char *DefaultExtension(OutputKind emit)
+{
+    static const char *ext[] = { ".bc", ".o", ".s", ".out", "" };
+    return ext[emit];
+}
+
+/*
+ * Times the lexer on its own by scanning the whole input once before it is
+ * parsed, so that the parse phase can be reported without it. Streams that
+ * cannot be rewound are not scanned twice, and make this return false.
+ */
+static bool timeLexer(FILE *in, const string &input, TimeReport *times, PhaseTime *lex)
+{
+    long start = ftell(in);
+    if (start < 0)
+        return false;
+    times->start("lex");
+    Session = new CompilationSession();
+    ScanProgram(in, input.c_str());
+    delete Session;
+    times->stop();
+    *lex = *times->last();
+    return fseek(in, start, SEEK_SET) == 0;
+}
+
+bool CompileStream(FILE *in, const string &input, const string &output, const CompileOptions &opts, int *exitCode,
+                   TimeReport *times, MemReport *mem)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    OutputKind emit = opts.emit;
+    TimeReport none;
+    PhaseTime lex;
+    bool lexed = times && timeLexer(in, input, times, &lex);
+    if (!times)
+        times = &none;
+
+    // The AST and token text only live until the IR has been built
+    LLVMContext Context;
+    Session = new CompilationSession();
+    times->start("parse");
+    ASTProgramNode *root = ParseProgram(in, input.c_str());
+    times->stop();
+    if (lexed)
+    {
+        // Parsing lexes again; only the rest is parsing proper
+        PhaseTime *parse = times->last();
+        parse->wall = max(0.0, parse->wall - lex.wall);
+        parse->user = max(0.0, parse->user - lex.user);
+        parse->system = max(0.0, parse->system - lex.system);
+    }
+    if (root)
+    {
+        times->start("fold");
+        FoldConstants(root);
+        times->stop();
+    }
+    PhaseTime workers;
+    workers.user = workers.system = 0;
+    times->start("irgen");
+    Module *DecafToLLVM = root ? BuildIR(root, input.c_str(), opts.jobs, Context, opts.incremental ? opts.cache : NULL,
+                                         &workers) : NULL;
+    if (mem && root)
+        RecordSessionMemory(Session, mem);
+    delete Session;
+    Session = NULL;
+    times->stop();
+    times->addCPU(workers);     // The threads generating methods, with -j
+    if (!DecafToLLVM)
+        return false;
+    if (mem)
+    {
+        RecordModuleSize(DecafToLLVM, &mem->module);
+        mem->hasModule = true;
+    }
+
+    bool ok = true;
+    TargetMachine *TM = NULL;
+    times->start("verify");
+    if (!VerifyIR(DecafToLLVM))
+    {
+        cerr << ProgName << ": Invalid IR generated for " << input << ".\n";
+        ok = false;
+    }
+    times->stop();
+
+    if (ok && opts.wholeProgram)
+    {
+        times->start("whole program");
+        InternalizeProgram(DecafToLLVM);
+        times->stop();
+        // It rewrites and deletes functions, and at -O0 nothing else verifies the result
+        times->start("verify whole program");
+        if (!VerifyIR(DecafToLLVM))
+        {
+            cerr << ProgName << ": Whole program IR for " << input << " is invalid.\n";
+            ok = false;
+        }
+        times->stop();
+    }
+
+    // The target is only needed when we generate native code ourselves
+    if (ok && emit != EMIT_BITCODE)
+    {
+        times->start("target");
+        TM = opts.target ? opts.target : CreateHostTargetMachine(opts.optLevel);
+        if (TM)
+            PrepareModuleForTarget(DecafToLLVM, TM);
+        else
+            ok = false;
+        times->stop();
+    }
+
+    if (ok)
+    {
+        times->start("optimize");
+        ok = OptimizeModule(DecafToLLVM, opts.optLevel, opts.pipeline, TM);
+        times->stop();
+        if (ok && mem && (opts.optLevel > 0 || !opts.pipeline.empty()))
+        {
+            RecordModuleSize(DecafToLLVM, &mem->optimized);
+            mem->hasOptimized = true;
+        }
+    }
+    if (ok && (opts.optLevel > 0 || !opts.pipeline.empty()))
+    {
+        times->start("verify optimized");
+        bool valid = VerifyIR(DecafToLLVM);
+        times->stop();
+        if (!valid)
+        {
+            cerr << ProgName << ": Optimized IR for " << input << " is invalid.\n";
+            ok = false;
+        }
+    }
+
+    if (ok)
+    {
+        times->start(emit == RUN_JIT ? "jit and run" : "emit");
+        switch (emit)
+        {
+            case EMIT_BITCODE:
+            {
+                error_code EC;
+                raw_fd_ostream bc_file(StringRef(output.c_str()), EC, llvm::sys::fs::F_None);
+                if (EC)
+                {
+                    cerr << ProgName << ": Cannot open " << output << ": " << EC.message() << "\n";
+                    ok = false;
+                    break;
+                }
+                WriteBitcodeToFile(DecafToLLVM, bc_file);
+                break;
+            }
+            case EMIT_OBJECT:
+            case EMIT_ASSEMBLY:
+                ok = EmitNativeFile(DecafToLLVM, TM, output, emit == EMIT_ASSEMBLY);
+                break;
+            case RUN_JIT:
+            {
+                double frontend = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                JITTimes jitTimes;
+                // The JIT takes the module over
+                ok = RunModuleJIT(DecafToLLVM, opts.optLevel, exitCode, &jitTimes);
+                DecafToLLVM = NULL;
+                if (ok)
+                    fprintf(stderr, "%s: compile %.3f ms (front end and optimizer %.3f ms, JIT %.3f ms), run %.3f ms\n",
+                            ProgName, (frontend + jitTimes.codegenSeconds) * 1e3, frontend * 1e3,
+                            jitTimes.codegenSeconds * 1e3, jitTimes.runSeconds * 1e3);
+                break;
+            }
+            case EMIT_EXECUTABLE:
+            {
+                // The object only lives long enough to be handed to the linker
+                SmallString<128> obj;
+                if (sys::fs::createTemporaryFile("decaf", "o", obj))
+                {
+                    cerr << ProgName << ": Cannot create a temporary object file.\n";
+                    ok = false;
+                    break;
+                }
+                ok = EmitNativeFile(DecafToLLVM, TM, obj.str(), false) &&
+                     LinkExecutable(vector<string>(1, obj.str()), output);
+                sys::fs::remove(obj.str());
+                break;
+            }
+        }
+        times->stop();
+    }
+
+    delete DecafToLLVM;
+    if (TM != opts.target)
+        delete TM;
+    return ok;
+}
+
+/* The options that change the output, for the cache key */
+static string describeOptions(const CompileOptions &opts)
+{
+    string flags = "-O" + to_string(opts.optLevel) + " -passes=" + opts.pipeline + " " + DefaultExtension(opts.emit);
+    if (opts.emit != EMIT_BITCODE)
+        flags += " " + DescribeHostTarget();
+    if (opts.wholeProgram)
+        flags += " --whole-program";
+    return flags;
+}
+
+bool CompileFile(const string &input, const string &output, const CompileOptions &opts, int *exitCode,
+                 TimeReport *times, MemReport *mem)
+{
+    FILE *in = fopen(input.c_str(), "r");
+    if (in == NULL)
+    {
+        cerr << ProgName << ": File " << input << " cannot be opened.\n";
+        return false;
+    }
+
+    // Executables also depend on the system linker and C library, so only plain outputs are cached
+    string key;
+    if (opts.cache && (opts.emit == EMIT_BITCODE || opts.emit == EMIT_OBJECT || opts.emit == EMIT_ASSEMBLY))
+    {
+        if (times)
+            times->start("cache lookup");
+        string source;
+        char buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+            source.append(buf, n);
+        rewind(in);
+        key = opts.cache->computeKey(source, describeOptions(opts));
+        bool hit = opts.cache->lookup(key, output);
+        if (times)
+            times->stop();
+        if (hit)
+        {
+            fclose(in);
+            opts.cache->flushStats();
+            return true;
+        }
+    }
+
+    bool ok = CompileStream(in, input, output, opts, exitCode, times, mem);
+    fclose(in);
+    if (times && opts.cache)
+        times->start("cache store");
+    if (ok && !key.empty())
+        opts.cache->store(key, output);
+    if (opts.cache)
+        opts.cache->flushStats();
+    if (times)
+        times->stop();
+    return ok;
+}
@@ -0,0 +1,122 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "include/emit.h"
+#include "include/stdllvm.h"
+using namespace std;
+using namespace llvm;
+
+CodeGenOpt::Level GetCodeGenOptLevel(int level) {
+	switch(level) {
+		case 0:
+			return CodeGenOpt::None;
+		case 1:
+			return CodeGenOpt::Less;
+		case 3:
+			return CodeGenOpt::Aggressive;
+		default:
+			return CodeGenOpt::Default;
+	}
+}
+
+/* Features of the host CPU, in the form createTargetMachine expects */
+static string getHostFeatures() {
+	SubtargetFeatures features;
+	StringMap<bool> hostFeatures;
+	if(sys::getHostCPUFeatures(hostFeatures)) {
+		for(StringMap<bool>::iterator it = hostFeatures.begin(); it != hostFeatures.end(); it++) {
+			features.AddFeature(it->first(), it->second);
+		}
+	}
+	return features.getString();
+}
+
+string DescribeHostTarget() {
+	return sys::getDefaultTargetTriple() + " " + sys::getHostCPUName().str() + " " + getHostFeatures();
+}
+
+TargetMachine *CreateHostTargetMachine(int level) {
+	InitializeNativeTarget();
+	InitializeNativeTargetAsmPrinter();
+
+	string triple = sys::getDefaultTargetTriple();
+	string err;
+	const Target *T = TargetRegistry::lookupTarget(triple, err);
+	if(!T) {
+		cerr << "Cannot find target for " << triple << ": " << err << endl;
+		return nullptr;
+	}
+
+	TargetOptions options;
+	return T->createTargetMachine(triple, sys::getHostCPUName(), getHostFeatures(),
+								options, Reloc::PIC_, CodeModel::Default,
+								GetCodeGenOptLevel(level));
+}
+
+void PrepareModuleForTarget(Module *M, TargetMachine *TM) {
+	M->setTargetTriple(TM->getTargetTriple());
+	M->setDataLayout(TM->getDataLayout());
+}
+
+bool EmitNativeFile(Module *M, TargetMachine *TM, const string &out, bool assembly) {
+	error_code EC;
+	tool_output_file Out(out.c_str(), EC, assembly ? sys::fs::F_Text : sys::fs::F_None);
+	if(EC) {
+		cerr << "Cannot open " << out << ": " << EC.message() << endl;
+		return false;
+	}
+
+	{
+		legacy::PassManager PM;
+		PM.add(new DataLayoutPass());
+		TM->addAnalysisPasses(PM);
+
+		formatted_raw_ostream FOS(Out.os());
+		TargetMachine::CodeGenFileType type = assembly ? TargetMachine::CGFT_AssemblyFile
+													   : TargetMachine::CGFT_ObjectFile;
+		if(TM->addPassesToEmitFile(PM, FOS, type)) {
+			cerr << "Target cannot emit a file of this type" << endl;
+			return false;
+		}
+		PM.run(*M);
+	}
+	Out.keep();
+	return true;
+}
+
+bool LinkExecutable(const vector<string> &objects, const string &out) {
+	ErrorOr<string> cc = sys::findProgramByName("cc");
+	if(!cc) {
+		cerr << "Cannot find the system compiler driver (cc) to link " << out << endl;
+		return false;
+	}
+
+	vector<const char *> args;
+	args.push_back(cc->c_str());
+	for(int i = 0; i < objects.size(); i++) {
+		args.push_back(objects[i].c_str());
+	}
+	// The runtime library (parallel loops) is installed next to the compiler
+	SmallString<128> runtime(sys::path::parent_path(sys::fs::getMainExecutable(nullptr, (void *)&LinkExecutable)));
+	sys::path::append(runtime, "libdecafrt.a");
+	if(sys::fs::exists(runtime.str())) {
+		args.push_back(runtime.c_str());
+	}
+	args.push_back("-lpthread");
+	args.push_back("-o");
+	args.push_back(out.c_str());
+	args.push_back(nullptr);
+
+	string err;
+	bool failed = false;
+	int status = sys::ExecuteAndWait(*cc, args.data(), nullptr, nullptr, 0, 0, &err, &failed);
+	if(failed || status != 0) {
+		cerr << "Linking " << out << " failed";
+		if(!err.empty()) {
+			cerr << ": " << err;
+		}
+		cerr << endl;
+		return false;
+	}
+	return true;
+}
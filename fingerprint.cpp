@@ -0,0 +1,243 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "include/fingerprint.h"
+#include "include/ast.h"
+#include "include/session.h"
+#include "include/stdllvm.h"
+using namespace std;
+using namespace llvm;
+
+/*
+ * Hashes one method. Every node adds its kind and its own data, and the
+ * number of children of every list, so that different trees cannot hash
+ * the same stream. The identifiers the method uses are collected to add
+ * what they refer to outside of the method.
+ */
+class FingerprintVisitor : public ASTVisitorBase<FingerprintVisitor, void> {
+	public:
+		FingerprintVisitor(MD5 &hash, vector<Ident> &names) : hash_(hash), names_(names) {}
+
+		void visit(ASTProgramNode *node) {
+			add(node->getKind());
+		}
+		void visit(ASTMethodDeclNode *node) {
+			add(node->getKind());
+			add(node->getType());
+			addName(node->getMethodName());
+			const ASTArray<ASTParameterDecl *> &params = node->getParamList();
+			add(params.size());
+			for(ASTArray<ASTParameterDecl *>::iterator it = params.begin(); it != params.end(); it++) {
+				add((*it)->getType());
+				add((*it)->getIfArray());
+				addName((*it)->getVarName());
+			}
+			dispatch(node->getBlock());
+		}
+		void visit(ASTBlock *node) {
+			add(node->getKind());
+			const ASTArray<ASTFieldDecl *> &fields = node->getFieldDeclList();
+			add(fields.size());
+			for(ASTArray<ASTFieldDecl *>::iterator it = fields.begin(); it != fields.end(); it++) {
+				addFieldDecl(*it);
+			}
+			const ASTArray<ASTStatementDeclNode *> &s = node->getStatementList();
+			add(s.size());
+			for(ASTArray<ASTStatementDeclNode *>::iterator it = s.begin(); it != s.end(); it++) {
+				dispatch(*it);
+			}
+		}
+		void visit(ASTBlockStatementNode *node) {
+			add(node->getKind());
+			dispatch(node->getBlock());
+		}
+		void visit(ASTAssignmentStatementNode *node) {
+			add(node->getKind());
+			add(node->getAssignmentOperator());
+			dispatch(node->getLocation());
+			dispatch(node->getExpression());
+		}
+		void visit(ASTSimpleMethodCallNode *node) {
+			add(node->getKind());
+			use(node->getMethodName());
+			const ASTArray<ASTExpressionNode *> &e = node->getExpressionList();
+			add(e.size());
+			for(ASTArray<ASTExpressionNode *>::iterator it = e.begin(); it != e.end(); it++) {
+				dispatch(*it);
+			}
+		}
+		void visit(ASTCalloutMethodCallNode *node) {
+			add(node->getKind());
+			addString(node->getFuncName());
+			const ASTArray<ASTCalloutArg *> &a = node->getArgumentList();
+			add(a.size());
+			for(ASTArray<ASTCalloutArg *>::iterator it = a.begin(); it != a.end(); it++) {
+				dispatch(*it);
+			}
+		}
+		void visit(ASTIfStatementDeclNode *node) {
+			add(node->getKind());
+			dispatch(node->getIfExpression());
+			dispatch(node->getIfBlock());
+			add(node->getElseBlock() != nullptr);
+			if(node->getElseBlock()) {
+				dispatch(node->getElseBlock());
+			}
+		}
+		void visit(ASTForStatementDeclNode *node) {
+			add(node->getKind());
+			add(node->isParallel());
+			addName(node->getIterVarName());
+			dispatch(node->getInitExpression());
+			dispatch(node->getFinalExpression());
+			dispatch(node->getForBody());
+		}
+		void visit(ASTReturnStatementNode *node) {
+			add(node->getKind());
+			dispatch(node->getReturnExpression());
+		}
+		void visit(ASTBreakStatementNode *node) {
+			add(node->getKind());
+		}
+		void visit(ASTContinueStatementNode *node) {
+			add(node->getKind());
+		}
+		void visit(ASTVarLocationNode *node) {
+			add(node->getKind());
+			use(node->getVar());
+		}
+		void visit(ASTArrayLocationNode *node) {
+			add(node->getKind());
+			use(node->getVar());
+			dispatch(node->getExpression());
+		}
+		void visit(ASTExpressionCalloutArg *node) {
+			add(node->getKind());
+			dispatch(node->getExpression());
+		}
+		void visit(ASTStringCalloutArg *node) {
+			add(node->getKind());
+			addString(node->getString());
+		}
+		void visit(ASTMethodCallExpressionNode *node) {
+			add(node->getKind());
+			dispatch(node->getMethodCallStatement());
+		}
+		void visit(ASTIntegerLiteralExpressionNode *node) {
+			add(node->getKind());
+			add(node->getValue());
+		}
+		void visit(ASTBoolLiteralExpressionNode *node) {
+			add(node->getKind());
+			add(node->getValue());
+		}
+		void visit(ASTCharLiteralExpressionNode *node) {
+			add(node->getKind());
+			add(node->getValue());
+		}
+		void visit(ASTLocationExpressionNode *node) {
+			add(node->getKind());
+			dispatch(node->getLocation());
+		}
+		void visit(ASTBinaryExpressionNode *node) {
+			add(node->getKind());
+			add(node->getOperatorId());
+			dispatch(node->left);
+			dispatch(node->right);
+		}
+		void visit(ASTUnaryExpressionNode *node) {
+			add(node->getKind());
+			add(node->getOperatorId());
+			dispatch(node->right);
+		}
+
+		void add(int v) {
+			hash_.update(ArrayRef<uint8_t>((const uint8_t *)&v, sizeof(v)));
+		}
+		void addString(StringRef s) {
+			add(s.size());
+			hash_.update(s);
+		}
+		void addName(Ident id) {
+			addString(Session->getName(id));
+		}
+		void addFieldDecl(ASTFieldDecl *decl) {
+			add(decl->getType());
+			const ASTArray<Symbol *> &vars = decl->getVariableList();
+			add(vars.size());
+			for(ASTArray<Symbol *>::iterator it = vars.begin(); it != vars.end(); it++) {
+				addName((*it)->id_);
+				add((*it)->literal_ ? (*it)->literal_->getValue() : -1);
+			}
+		}
+
+	private:
+		void use(Ident id) {
+			addName(id);
+			names_.push_back(id);
+		}
+
+		MD5 &hash_;
+		vector<Ident> &names_;
+};
+
+/* Orders handles by their names, which unlike the handles do not depend on the rest of the file */
+static bool nameLess(Ident a, Ident b) {
+	return Session->getName(a) < Session->getName(b);
+}
+
+void FingerprintMethods(ASTProgramNode *root, vector<string> &fingerprints) {
+	// What a name used in a method can refer to outside of it
+	map<Ident, pair<int, int> > fields;				// Type and array size (-1 for scalars)
+	const ASTArray<ASTFieldDecl *> &decls = root->getFieldDeclList();
+	for(ASTArray<ASTFieldDecl *>::iterator d = decls.begin(); d != decls.end(); d++) {
+		const ASTArray<Symbol *> &vars = (*d)->getVariableList();
+		for(ASTArray<Symbol *>::iterator it = vars.begin(); it != vars.end(); it++) {
+			fields[(*it)->id_] = make_pair((*d)->getType(), (*it)->literal_ ? (*it)->literal_->getValue() : -1);
+		}
+	}
+	const ASTArray<ASTMethodDeclNode *> &methods = root->getMethodDeclList();
+	map<Ident, ASTMethodDeclNode *> signatures;
+	for(ASTArray<ASTMethodDeclNode *>::iterator m = methods.begin(); m != methods.end(); m++) {
+		signatures[(*m)->getMethodName()] = *m;
+	}
+
+	fingerprints.clear();
+	for(ASTArray<ASTMethodDeclNode *>::iterator m = methods.begin(); m != methods.end(); m++) {
+		MD5 hash;
+		vector<Ident> names;
+		FingerprintVisitor v(hash, names);
+		v.dispatch(*m);
+
+		std::sort(names.begin(), names.end());
+		names.erase(unique(names.begin(), names.end()), names.end());
+		std::sort(names.begin(), names.end(), nameLess);
+		for(unsigned i = 0; i < names.size(); i++) {
+			// A local of the same name may hide the field; hashing it anyway is only conservative
+			map<Ident, pair<int, int> >::iterator f = fields.find(names[i]);
+			if(f != fields.end()) {
+				v.addName(names[i]);
+				v.add(f->second.first);
+				v.add(f->second.second);
+			}
+			map<Ident, ASTMethodDeclNode *>::iterator callee = signatures.find(names[i]);
+			if(callee != signatures.end()) {
+				ASTMethodDeclNode *c = callee->second;
+				v.addName(names[i]);
+				v.add(c->getType());
+				const ASTArray<ASTParameterDecl *> &params = c->getParamList();
+				v.add(params.size());
+				for(ASTArray<ASTParameterDecl *>::iterator p = params.begin(); p != params.end(); p++) {
+					v.add((*p)->getType());
+				}
+			}
+		}
+
+		MD5::MD5Result result;
+		hash.final(result);
+		SmallString<32> hex;
+		MD5::stringifyResult(result, hex);
+		fingerprints.push_back(hex.str().str());
+	}
+}
@@ -0,0 +1,415 @@
+#include <climits>
+#include <stdint.h>
+#include "include/fold.h"
+#include "include/ast.h"
+#include "include/session.h"
+using namespace std;
+
+static bool intValue(ASTExpressionNode *e, int *v) {
+	if(e->getKind() == AST_INTEGER_LITERAL) {
+		*v = static_cast<ASTIntegerLiteralExpressionNode *>(e)->getValue();
+		return true;
+	}
+	if(e->getKind() == AST_CHAR_LITERAL) {
+		*v = static_cast<ASTCharLiteralExpressionNode *>(e)->getValue();
+		return true;
+	}
+	return false;
+}
+
+static bool boolValue(ASTExpressionNode *e, bool *v) {
+	if(e->getKind() == AST_BOOL_LITERAL) {
+		*v = static_cast<ASTBoolLiteralExpressionNode *>(e)->getValue();
+		return true;
+	}
+	return false;
+}
+
+static bool isInt(ASTExpressionNode *e, int v) {
+	int value;
+	return intValue(e, &value) && value == v;
+}
+
+/* k if c is 2^k as a 32 bit pattern, -1 otherwise */
+static int exactLog2(int c) {
+	uint32_t u = c;
+	if(u == 0 || (u & (u - 1))) {
+		return -1;
+	}
+	int k = 0;
+	while(u >>= 1) {
+		k++;
+	}
+	return k;
+}
+
+/* Whether evaluating e has no effect besides its value : no method calls in it */
+static bool isPure(ASTExpressionNode *e) {
+	switch(e->getKind()) {
+		case AST_INTEGER_LITERAL:
+		case AST_CHAR_LITERAL:
+		case AST_BOOL_LITERAL:
+			return true;
+		case AST_LOCATION_EXPRESSION: {
+			ASTLocationNode *loc = static_cast<ASTLocationExpressionNode *>(e)->getLocation();
+			if(loc->getKind() == AST_ARRAY_LOCATION) {
+				return isPure(static_cast<ASTArrayLocationNode *>(loc)->getExpression());
+			}
+			return true;
+		}
+		case AST_BINARY_EXPRESSION:
+			return isPure(e->left) && isPure(e->right);
+		case AST_UNARY_EXPRESSION:
+			return isPure(e->right);
+		default:
+			return false;
+	}
+}
+
+/* Whether e can be evaluated more than once at the cost of a load : a scalar variable */
+static bool isScalar(ASTExpressionNode *e) {
+	return e->getKind() == AST_LOCATION_EXPRESSION &&
+		   static_cast<ASTLocationExpressionNode *>(e)->getLocation()->getKind() == AST_VAR_LOCATION;
+}
+
+/*
+ * Rewrites every expression bottom up : dispatch on an expression returns
+ * the expression to use in its place, which the parent stores back. The
+ * statements and locations only fold the expressions they hold.
+ */
+class FoldVisitor : public ASTVisitorBase<FoldVisitor, ASTExpressionNode *> {
+	public:
+		ASTExpressionNode *visit(ASTProgramNode *node) {
+			const ASTArray<ASTMethodDeclNode *> &methods = node->getMethodDeclList();
+			for(ASTArray<ASTMethodDeclNode *>::iterator it = methods.begin(); it != methods.end(); it++) {
+				dispatch(*it);
+			}
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTMethodDeclNode *node) {
+			dispatch(node->getBlock());
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTBlock *node) {
+			const ASTArray<ASTStatementDeclNode *> &s = node->getStatementList();
+			for(ASTArray<ASTStatementDeclNode *>::iterator it = s.begin(); it != s.end(); it++) {
+				dispatch(*it);
+			}
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTBlockStatementNode *node) {
+			dispatch(node->getBlock());
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTAssignmentStatementNode *node) {
+			dispatch(node->getLocation());
+			node->setExpression(fold(node->getExpression()));
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTSimpleMethodCallNode *node) {
+			const ASTArray<ASTExpressionNode *> &e = node->getExpressionList();
+			for(ASTArray<ASTExpressionNode *>::iterator it = e.begin(); it != e.end(); it++) {
+				*it = fold(*it);
+			}
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTCalloutMethodCallNode *node) {
+			const ASTArray<ASTCalloutArg *> &a = node->getArgumentList();
+			for(ASTArray<ASTCalloutArg *>::iterator it = a.begin(); it != a.end(); it++) {
+				dispatch(*it);
+			}
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTIfStatementDeclNode *node) {
+			node->setIfExpression(fold(node->getIfExpression()));
+			dispatch(node->getIfBlock());
+			if(node->getElseBlock()) {
+				dispatch(node->getElseBlock());
+			}
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTForStatementDeclNode *node) {
+			node->setInitExpression(fold(node->getInitExpression()));
+			node->setFinalExpression(fold(node->getFinalExpression()));
+			dispatch(node->getForBody());
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTReturnStatementNode *node) {
+			node->setReturnExpression(fold(node->getReturnExpression()));
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTBreakStatementNode *node) {
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTContinueStatementNode *node) {
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTVarLocationNode *node) {
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTArrayLocationNode *node) {
+			node->setExpression(fold(node->getExpression()));
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTExpressionCalloutArg *node) {
+			node->setExpression(fold(node->getExpression()));
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTStringCalloutArg *node) {
+			return nullptr;
+		}
+		ASTExpressionNode *visit(ASTMethodCallExpressionNode *node) {
+			dispatch(node->getMethodCallStatement());
+			return node;
+		}
+		ASTExpressionNode *visit(ASTIntegerLiteralExpressionNode *node) {
+			return node;
+		}
+		ASTExpressionNode *visit(ASTCharLiteralExpressionNode *node) {
+			return node;
+		}
+		ASTExpressionNode *visit(ASTBoolLiteralExpressionNode *node) {
+			return node;
+		}
+		ASTExpressionNode *visit(ASTLocationExpressionNode *node) {
+			dispatch(node->getLocation());
+			return node;
+		}
+		ASTExpressionNode *visit(ASTBinaryExpressionNode *node);
+		ASTExpressionNode *visit(ASTUnaryExpressionNode *node);
+
+	private:
+		ASTExpressionNode *fold(ASTExpressionNode *e) {
+			return e ? dispatch(e) : e;
+		}
+
+		ASTExpressionNode *intLiteral(int v) {
+			return Session->make<ASTIntegerLiteralExpressionNode>(v);
+		}
+		ASTExpressionNode *boolLiteral(bool v) {
+			return Session->make<ASTBoolLiteralExpressionNode>(v);
+		}
+		ASTExpressionNode *binary(ASTExpressionNode *L, int op, ASTExpressionNode *R) {
+			return Session->make<ASTBinaryExpressionNode>(L, R, op);
+		}
+		ASTExpressionNode *unary(int op, ASTExpressionNode *R) {
+			return Session->make<ASTUnaryExpressionNode>(R, op);
+		}
+
+		ASTExpressionNode *foldInts(int op, int a, int b);
+		ASTExpressionNode *foldBools(int op, bool a, bool b);
+		ASTExpressionNode *roundingBias(ASTExpressionNode *x, int k);
+		ASTExpressionNode *multiply(ASTBinaryExpressionNode *node);
+		ASTExpressionNode *divide(ASTBinaryExpressionNode *node);
+		ASTExpressionNode *logical(ASTBinaryExpressionNode *node);
+};
+
+/* a op b, wrapping around as the generated code does; nullptr if it traps or is not an int operator */
+ASTExpressionNode *FoldVisitor::foldInts(int op, int a, int b) {
+	uint32_t ua = a, ub = b;
+	switch(op) {
+		case _plus:
+			return intLiteral(ua + ub);
+		case _minus:
+			return intLiteral(ua - ub);
+		case _mult:
+			return intLiteral(ua * ub);
+		case _div:
+		case _mod:
+			if(b == 0 || (a == INT_MIN && b == -1)) {
+				return nullptr;
+			}
+			return intLiteral(op == _div ? a / b : a % b);
+		case _eq:
+			return boolLiteral(a == b);
+		case _neq:
+			return boolLiteral(a != b);
+		case _gt:
+			return boolLiteral(a > b);
+		case _lt:
+			return boolLiteral(a < b);
+		case _gteq:
+			return boolLiteral(a >= b);
+		case _lteq:
+			return boolLiteral(a <= b);
+	}
+	return nullptr;
+}
+
+ASTExpressionNode *FoldVisitor::foldBools(int op, bool a, bool b) {
+	switch(op) {
+		case _and:
+			return boolLiteral(a && b);
+		case _or:
+			return boolLiteral(a || b);
+		case _eq:
+			return boolLiteral(a == b);
+		case _neq:
+			return boolLiteral(a != b);
+	}
+	return nullptr;
+}
+
+/* 2^k - 1 when x is negative, 0 otherwise : what x needs to round towards zero when shifted by k */
+ASTExpressionNode *FoldVisitor::roundingBias(ASTExpressionNode *x, int k) {
+	ASTExpressionNode *sign = binary(x, _ashr, intLiteral(31));
+	return binary(sign, _lshr, intLiteral(32 - k));
+}
+
+/* x * c, with the constant on the right once the operands are folded */
+ASTExpressionNode *FoldVisitor::multiply(ASTBinaryExpressionNode *node) {
+	ASTExpressionNode *x = node->left;
+	int c;
+	if(!intValue(node->right, &c)) {
+		return node;
+	}
+	if(c == 1) {
+		return x;
+	}
+	if(c == 0 && isPure(x)) {
+		return intLiteral(0);
+	}
+	if(c == -1) {
+		return unary(_unaryminus, x);
+	}
+	int k = exactLog2(c);
+	if(k > 0) {
+		return binary(x, _shl, intLiteral(k));
+	}
+	return node;
+}
+
+/*
+ * x / c and x % c. Signed division by 2^k is a shift of x biased towards
+ * zero, and the remainder is what that quotient leaves : x - ((x + bias) &
+ * -2^k). Both use x more than once, so only a scalar variable is rewritten.
+ */
+ASTExpressionNode *FoldVisitor::divide(ASTBinaryExpressionNode *node) {
+	ASTExpressionNode *x = node->left;
+	bool isDiv = node->getOperatorId() == _div;
+	int c;
+	if(!intValue(node->right, &c)) {
+		return node;
+	}
+	if(c == 1 || c == -1) {
+		if(isDiv) {
+			return c == 1 ? x : unary(_unaryminus, x);
+		}
+		return isPure(x) ? intLiteral(0) : node;
+	}
+	int k = exactLog2(c);
+	if(c < 0 || k < 0 || !isScalar(x)) {
+		return node;
+	}
+	ASTExpressionNode *biased = binary(x, _plus, roundingBias(x, k));
+	if(isDiv) {
+		return binary(biased, _ashr, intLiteral(k));
+	}
+	return binary(x, _minus, binary(biased, _bitand, intLiteral(-c)));
+}
+
+/*
+ * && and || with a literal operand. The left operand always runs, the
+ * right one only when the left does not decide, so a literal on the left
+ * decides which one is left, and one on the right can only go with a
+ * left operand that has no effect.
+ */
+ASTExpressionNode *FoldVisitor::logical(ASTBinaryExpressionNode *node) {
+	bool isAnd = node->getOperatorId() == _and;
+	bool v;
+	if(boolValue(node->left, &v)) {
+		// true && b, false || b are b; false && b, true || b are the literal
+		return v == isAnd ? node->right : node->left;
+	}
+	if(boolValue(node->right, &v)) {
+		if(v == isAnd) {
+			return node->left;
+		}
+		if(isPure(node->left)) {
+			return node->right;
+		}
+	}
+	return node;
+}
+
+ASTExpressionNode *FoldVisitor::visit(ASTBinaryExpressionNode *node) {
+	node->left = fold(node->left);
+	node->right = fold(node->right);
+	ASTExpressionNode *L = node->left;
+	ASTExpressionNode *R = node->right;
+	int op = node->getOperatorId();
+
+	int a, b;
+	bool p, q;
+	ASTExpressionNode *folded = nullptr;
+	if(intValue(L, &a) && intValue(R, &b)) {
+		folded = foldInts(op, a, b);
+	}
+	else if(boolValue(L, &p) && boolValue(R, &q)) {
+		folded = foldBools(op, p, q);
+	}
+	if(folded) {
+		return folded;
+	}
+
+	switch(op) {
+		case _plus:
+			if(isInt(R, 0)) {
+				return L;
+			}
+			if(isInt(L, 0)) {
+				return R;
+			}
+			return node;
+		case _minus:
+			return isInt(R, 0) ? L : node;
+		case _mult:
+			// A literal has no effect, so moving it to the right changes nothing
+			if(intValue(L, &a) && !intValue(R, &b)) {
+				node->left = R;
+				node->right = L;
+			}
+			return multiply(node);
+		case _div:
+		case _mod:
+			return divide(node);
+		case _and:
+		case _or:
+			return logical(node);
+		case _eq:
+		case _neq:
+			// b == true and b != false are b, the other two are !b
+			if(boolValue(R, &q)) {
+				return q == (op == _eq) ? L : unary(_negate, L);
+			}
+			if(boolValue(L, &p)) {
+				return p == (op == _eq) ? R : unary(_negate, R);
+			}
+			return node;
+	}
+	return node;
+}
+
+ASTExpressionNode *FoldVisitor::visit(ASTUnaryExpressionNode *node) {
+	node->right = fold(node->right);
+	ASTExpressionNode *R = node->right;
+	int op = node->getOperatorId();
+	int a;
+	bool p;
+	if(op == _unaryminus && intValue(R, &a)) {
+		return intLiteral(0u - (uint32_t)a);
+	}
+	if(op == _negate && boolValue(R, &p)) {
+		return boolLiteral(!p);
+	}
+	// -(-x) and !!b
+	if(R->getKind() == AST_UNARY_EXPRESSION && static_cast<ASTUnaryExpressionNode *>(R)->getOperatorId() == op) {
+		return R->right;
+	}
+	return node;
+}
+
+void FoldConstants(ASTProgramNode *root) {
+	FoldVisitor folder;
+	folder.dispatch(root);
+}
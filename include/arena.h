@@ -0,0 +1,58 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <cstddef>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Allocator.h>
+using namespace std;
+using namespace llvm;
+
+/*
+ * Children of an AST node, stored contiguously in the arena. The array is
+ * built once, when the parser has seen the whole list, and never changes
+ * after that. It is held by value in its node, so iterating it touches one
+ * block of memory instead of following a pointer per element.
+ */
+template <typename T>
+class ASTArray {
+	public:
+		typedef T *iterator;
+		typedef const T *const_iterator;
+
+		ASTArray() : data_(nullptr), size_(0) {}
+		ASTArray(T *data, unsigned size) : data_(data), size_(size) {}
+
+		iterator begin() const {
+			return data_;
+		}
+		iterator end() const {
+			return data_ + size_;
+		}
+		unsigned size() const {
+			return size_;
+		}
+		bool empty() const {
+			return size_ == 0;
+		}
+		T &operator[](unsigned i) const {
+			return data_[i];
+		}
+		T &front() const {
+			return data_[0];
+		}
+		T &back() const {
+			return data_[size_ - 1];
+		}
+
+	private:
+		T *data_;
+		unsigned size_;
+};
+
+/*
+ * A list the parser is still adding to. Builders are recycled by the
+ * session, so only the finished ASTArray ends up in the arena.
+ */
+typedef SmallVector<void *, 8> ListBuilder;
+
+#endif
@@ -88,7 +88,13 @@
 #include <stdlib.h>
 #include <string>
 #include <map>
+#include <set>
+#include <vector>
 #include <list>
+#include <stack>
+#include "arena.h"				// Contiguous child arrays
+#include "session.h"			// Interned identifiers
+#include "symtab.h"				// Scopes of the code generator
 #include "stdllvm.h"			// LLVM Header files necessary for Code Generation
 using namespace std;
 using namespace llvm;
@@ -114,11 +120,63 @@ const int _lteq = 8192;
 const int _unaryminus = 16384;
 const int _negate = 32768;
 const int _mod = 65536;
+const int _assign = 131072;
+const int _plusassign = 262144;
+const int _minusassign = 524288;
+
+/* Operators only produced by FoldConstants, never by the parser */
+const int _shl = 1048576;
+const int _ashr = 2097152;
+const int _lshr = 4194304;
+const int _bitand = 8388608;
+
+/* Concrete class of every AST node, used to dispatch without virtual calls */
+enum ASTKind {
+	AST_PROGRAM,
+	AST_METHOD_DECL,
+	AST_BLOCK,
+	AST_BLOCK_STATEMENT,
+	AST_ASSIGNMENT_STATEMENT,
+	AST_SIMPLE_METHOD_CALL,
+	AST_CALLOUT_METHOD_CALL,
+	AST_IF_STATEMENT,
+	AST_FOR_STATEMENT,
+	AST_RETURN_STATEMENT,
+	AST_BREAK_STATEMENT,
+	AST_CONTINUE_STATEMENT,
+	AST_VAR_LOCATION,
+	AST_ARRAY_LOCATION,
+	AST_EXPRESSION_CALLOUT_ARG,
+	AST_STRING_CALLOUT_ARG,
+	AST_METHOD_CALL_EXPRESSION,
+	AST_INTEGER_LITERAL,
+	AST_CHAR_LITERAL,
+	AST_BOOL_LITERAL,
+	AST_LOCATION_EXPRESSION,
+	AST_BINARY_EXPRESSION,
+	AST_UNARY_EXPRESSION
+};
+
+/* Classes allocated in the session that are not nodes, numbered after the node kinds */
+enum {
+	ARENA_SYMBOL = AST_UNARY_EXPRESSION + 1,
+	ARENA_FIELD_DECL,
+	ARENA_PARAMETER_DECL,
+	NUM_ARENA_TYPES
+};
 
 /* Parent class of the Abstract Syntax Tree */
 class ASTNode {
 	public:
+		ASTNode(ASTKind k) : kind_(k) {}
+
+		ASTKind getKind() const {
+			return kind_;
+		}
 		virtual Value *accept(class Visitor *) = 0;
+
+	private:
+		ASTKind kind_;
 };
 
 class ASTExpressionNode : public ASTNode {
@@ -126,13 +184,13 @@ class ASTExpressionNode : public ASTNode {
 		ASTExpressionNode* left;
 		ASTExpressionNode* right;
 
-		ASTExpressionNode(ASTExpressionNode *l, ASTExpressionNode *r) : left(l), right(r) {}
-		ASTExpressionNode() : left(NULL), right(NULL) {}
+		ASTExpressionNode(ASTKind k, ASTExpressionNode *l, ASTExpressionNode *r) : ASTNode(k), left(l), right(r) {}
+		ASTExpressionNode(ASTKind k) : ASTNode(k), left(NULL), right(NULL) {}
 };
 
 class ASTParameterDecl {
 	public:
-		ASTParameterDecl(int t, string name, bool arr) {
+		ASTParameterDecl(int t, Ident name, bool arr) {
 			type_ = t;
 			varName_ = name;
 			isArray_ = arr;
@@ -140,7 +198,7 @@ class ASTParameterDecl {
 		const int getType() const {
 			return type_;
 		}
-		string getVarName() {
+		Ident getVarName() const {
 			return varName_;
 		}
 		const bool getIfArray() const {
@@ -149,39 +207,58 @@ class ASTParameterDecl {
 
 	private:
 		int type_;
-		string varName_;
+		Ident varName_;
 		bool isArray_;
 };
 
-class ASTStatementDeclNode : public ASTNode {
-	public:
-		ASTStatementDeclNode(const int id) : statementId_(id) {}
+class Symbol;
 
-		const int getStatementId() const {
-			return statementId_;
+/* One FieldDecl : a type and the variables declared with it */
+class ASTFieldDecl {
+	public:
+		ASTFieldDecl(int t, ASTArray<Symbol *> vars) {
+			type_ = t;
+			variableList_ = vars;
+		}
+		const int getType() const {
+			return type_;
+		}
+		const ASTArray<Symbol *> &getVariableList() const {
+			return variableList_;
 		}
 
 	private:
-		int statementId_;
+		int type_;
+		ASTArray<Symbol *> variableList_;
+};
+
+class ASTStatementDeclNode : public ASTNode {
+	public:
+		ASTStatementDeclNode(ASTKind k) : ASTNode(k) {}
 };
 
 class ASTBlock : public ASTNode {
 	public:
-		ASTBlock(list<ASTStatementDeclNode *> *s) {
+		ASTBlock(ASTArray<ASTFieldDecl *> d, ASTArray<ASTStatementDeclNode *> s) : ASTNode(AST_BLOCK) {
+			fieldDeclList_ = d;
 			statementList_ = s;
 		}
-		list<ASTStatementDeclNode *> *getStatementList() {
+		const ASTArray<ASTFieldDecl *> &getFieldDeclList() const {
+			return fieldDeclList_;
+		}
+		const ASTArray<ASTStatementDeclNode *> &getStatementList() const {
 			return statementList_;
 		}
 		Value *accept(Visitor *) override;
 
 	private:
-		list<ASTStatementDeclNode *> *statementList_;
+		ASTArray<ASTFieldDecl *> fieldDeclList_;
+		ASTArray<ASTStatementDeclNode *> statementList_;
 };
 
 class ASTMethodDeclNode : public ASTNode {
 	public:
-		ASTMethodDeclNode(int t, string name, list<ASTParameterDecl *> *p, ASTBlock *b) {
+		ASTMethodDeclNode(int t, Ident name, ASTArray<ASTParameterDecl *> p, ASTBlock *b) : ASTNode(AST_METHOD_DECL) {
 			type_ = t;
 			methodName_ = name;
 			params_ = p;
@@ -190,10 +267,10 @@ class ASTMethodDeclNode : public ASTNode {
 		const int getType() const {
 			return type_;
 		}
-		string getMethodName() const {
+		Ident getMethodName() const {
 			return methodName_;
 		}
-		list<ASTParameterDecl *> *getParamList() {
+		const ASTArray<ASTParameterDecl *> &getParamList() const {
 			return params_;
 		}
 		ASTBlock *getBlock() const {
@@ -203,14 +280,14 @@ class ASTMethodDeclNode : public ASTNode {
 
 	private:
 		int type_;
-		string methodName_;
-		list<ASTParameterDecl *> *params_;
+		Ident methodName_;
+		ASTArray<ASTParameterDecl *> params_;
 		ASTBlock *block_;
 };
 
 class ASTBlockStatementNode : public ASTStatementDeclNode {
 	public:
-		ASTBlockStatementNode(ASTBlock *b) : ASTStatementDeclNode(1) {
+		ASTBlockStatementNode(ASTBlock *b) : ASTStatementDeclNode(AST_BLOCK_STATEMENT) {
 			block_ = b;
 		}
 		ASTBlock *getBlock() const {
@@ -224,28 +301,33 @@ class ASTBlockStatementNode : public ASTStatementDeclNode {
 
 class ASTLocationNode : public ASTNode {
 	public:
-		ASTLocationNode(bool isArray) : isArray_(isArray) {}
+		ASTLocationNode(ASTKind k, bool isArray) : ASTNode(k), isArray_(isArray) {}
 
 		bool isArray_;
 };
 
 class ASTProgramNode : public ASTNode {
 	public:
-		ASTProgramNode(list<ASTMethodDeclNode *> *List) {
+		ASTProgramNode(ASTArray<ASTFieldDecl *> Fields, ASTArray<ASTMethodDeclNode *> List) : ASTNode(AST_PROGRAM) {
+			fieldDeclList_ = Fields;
 			methodDeclList_ = List;
 		}
-		list<ASTMethodDeclNode *> *getMethodDeclList() const {
+		const ASTArray<ASTFieldDecl *> &getFieldDeclList() const {
+			return fieldDeclList_;
+		}
+		const ASTArray<ASTMethodDeclNode *> &getMethodDeclList() const {
 			return methodDeclList_;
 		}
 		Value *accept(Visitor *) override;
 
 	private:
-		list<ASTMethodDeclNode *> *methodDeclList_;
+		ASTArray<ASTFieldDecl *> fieldDeclList_;
+		ASTArray<ASTMethodDeclNode *> methodDeclList_;
 };
 
 class ASTAssignmentStatementNode : public ASTStatementDeclNode {
 	public:
-		ASTAssignmentStatementNode(ASTLocationNode *loc, string op, ASTExpressionNode *ex) : ASTStatementDeclNode(1) {
+		ASTAssignmentStatementNode(ASTLocationNode *loc, int op, ASTExpressionNode *ex) : ASTStatementDeclNode(AST_ASSIGNMENT_STATEMENT) {
 			location_ = loc;
 			operator_ = op;
 			expr_ = ex;
@@ -256,7 +338,10 @@ class ASTAssignmentStatementNode : public ASTStatementDeclNode {
 		ASTExpressionNode *getExpression() const {
 			return expr_;
 		}
-		const string getAssignmentOperator() const {
+		void setExpression(ASTExpressionNode *ex) {
+			expr_ = ex;
+		}
+		const int getAssignmentOperator() const {
 			return operator_;
 		}
 		Value *accept(Visitor *) override;
@@ -264,12 +349,12 @@ class ASTAssignmentStatementNode : public ASTStatementDeclNode {
 	private:
 		ASTLocationNode *location_;
 		ASTExpressionNode *expr_;
-		string operator_;
+		int operator_;
 };
 
 class ASTMethodCallStatementNode : public ASTStatementDeclNode {
 	public:
-		ASTMethodCallStatementNode(bool isCallout) : ASTStatementDeclNode(1) {
+		ASTMethodCallStatementNode(ASTKind k, bool isCallout) : ASTStatementDeclNode(k) {
 			isCallout_ = isCallout;
 		}
 
@@ -279,47 +364,50 @@ class ASTMethodCallStatementNode : public ASTStatementDeclNode {
 
 class ASTSimpleMethodCallNode : public ASTMethodCallStatementNode {
 	public:
-		ASTSimpleMethodCallNode(string name, list<ASTExpressionNode *> *list) : ASTMethodCallStatementNode(false) {
+		ASTSimpleMethodCallNode(Ident name, ASTArray<ASTExpressionNode *> list) : ASTMethodCallStatementNode(AST_SIMPLE_METHOD_CALL, false) {
 			methodName_ = name;
 			exprList_ = list;
 		}
-		const string getMethodName() const {
+		Ident getMethodName() const {
 			return methodName_;
 		}
-		list<ASTExpressionNode *> *getExpressionList() const {
+		const ASTArray<ASTExpressionNode *> &getExpressionList() const {
 			return exprList_;
 		}
 		Value *accept(Visitor *) override;
 
 	private:
-		string methodName_;
-		list<ASTExpressionNode *> *exprList_;
+		Ident methodName_;
+		ASTArray<ASTExpressionNode *> exprList_;
 };
 
-class ASTCalloutArg : public ASTNode {};
+class ASTCalloutArg : public ASTNode {
+	public:
+		ASTCalloutArg(ASTKind k) : ASTNode(k) {}
+};
 
 class ASTCalloutMethodCallNode : public ASTMethodCallStatementNode {
 	public:
-		ASTCalloutMethodCallNode(string fname, list<ASTCalloutArg *> *List) : ASTMethodCallStatementNode(true) {
+		ASTCalloutMethodCallNode(StringRef fname, ASTArray<ASTCalloutArg *> List) : ASTMethodCallStatementNode(AST_CALLOUT_METHOD_CALL, true) {
 			func_ = fname;
 			argList_ = List;
 		}
-		const string getFuncName() const {
+		StringRef getFuncName() const {
 			return func_;
 		}
-		list<ASTCalloutArg *> *getArgumentList() const {
+		const ASTArray<ASTCalloutArg *> &getArgumentList() const {
 			return argList_;
 		}
 		Value *accept(Visitor *) override;
 
 	private:
-		string func_;
-		list<ASTCalloutArg *> *argList_;
+		StringRef func_;
+		ASTArray<ASTCalloutArg *> argList_;
 };
 
 class ASTIfStatementDeclNode : public ASTStatementDeclNode {
 	public:
-		ASTIfStatementDeclNode(ASTExpressionNode *ifExp, ASTBlock *ifBlock, ASTBlock *elseBlock) : ASTStatementDeclNode(1) {
+		ASTIfStatementDeclNode(ASTExpressionNode *ifExp, ASTBlock *ifBlock, ASTBlock *elseBlock) : ASTStatementDeclNode(AST_IF_STATEMENT) {
 			ifExpression_ = ifExp;
 			ifBlock_ = ifBlock;
 			elseBlock_ = elseBlock;
@@ -327,6 +415,9 @@ class ASTIfStatementDeclNode : public ASTStatementDeclNode {
 		ASTExpressionNode *getIfExpression() const {
 			return ifExpression_;
 		}
+		void setIfExpression(ASTExpressionNode *ifExp) {
+			ifExpression_ = ifExp;
+		}
 		ASTBlock *getIfBlock() const {
 			return ifBlock_;
 		}
@@ -343,13 +434,14 @@ class ASTIfStatementDeclNode : public ASTStatementDeclNode {
 
 class ASTForStatementDeclNode : public ASTStatementDeclNode {
 	public:
-		ASTForStatementDeclNode(string it, ASTExpressionNode *init, ASTExpressionNode *end, ASTBlock *b) : ASTStatementDeclNode(1) {
+		ASTForStatementDeclNode(Ident it, ASTExpressionNode *init, ASTExpressionNode *end, ASTBlock *b, bool parallel = false) : ASTStatementDeclNode(AST_FOR_STATEMENT) {
 			iterName_ = it;
 			initExpression_ = init;
 			finalExpression_ = end;
 			block_ = b;
+			parallel_ = parallel;
 		}
-		const string getIterVarName() const {
+		Ident getIterVarName() const {
 			return iterName_;
 		}
 		ASTExpressionNode *getInitExpression() const {
@@ -358,26 +450,40 @@ class ASTForStatementDeclNode : public ASTStatementDeclNode {
 		ASTExpressionNode *getFinalExpression() const {
 			return finalExpression_;
 		}
+		void setInitExpression(ASTExpressionNode *init) {
+			initExpression_ = init;
+		}
+		void setFinalExpression(ASTExpressionNode *end) {
+			finalExpression_ = end;
+		}
 		ASTBlock *getForBody() {
 			return block_;
 		}
+		/* Iterations may run concurrently, in any order */
+		bool isParallel() const {
+			return parallel_;
+		}
 		Value *accept(Visitor *) override;
 
 	private:
-		string iterName_;
+		Ident iterName_;
 		ASTExpressionNode *initExpression_;
 		ASTExpressionNode *finalExpression_;
 		ASTBlock *block_;
+		bool parallel_;
 };
 
 class ASTReturnStatementNode : public ASTStatementDeclNode {
 	public:
-		ASTReturnStatementNode(ASTExpressionNode *ex) : ASTStatementDeclNode(1) {
+		ASTReturnStatementNode(ASTExpressionNode *ex) : ASTStatementDeclNode(AST_RETURN_STATEMENT) {
 			returnExpr_ = ex;
 		}
 		ASTExpressionNode *getReturnExpression() const {
 			return returnExpr_;
 		}
+		void setReturnExpression(ASTExpressionNode *ex) {
+			returnExpr_ = ex;
+		}
 		Value *accept(Visitor *) override;
 
 	private:
@@ -386,52 +492,58 @@ class ASTReturnStatementNode : public ASTStatementDeclNode {
 
 class ASTBreakStatementNode : public ASTStatementDeclNode {
 	public:
-		ASTBreakStatementNode() : ASTStatementDeclNode(1) {}
+		ASTBreakStatementNode() : ASTStatementDeclNode(AST_BREAK_STATEMENT) {}
 		Value *accept(Visitor *) override;
 };
 
 class ASTContinueStatementNode : public ASTStatementDeclNode {
 	public:
-		ASTContinueStatementNode() : ASTStatementDeclNode(1) {}
+		ASTContinueStatementNode() : ASTStatementDeclNode(AST_CONTINUE_STATEMENT) {}
 		Value *accept(Visitor *) override;
 };
 
 class ASTVarLocationNode : public ASTLocationNode {
 	public:
-		ASTVarLocationNode(string id) : var_(id), ASTLocationNode(false) {}
-		const string getVar() const {
+		ASTVarLocationNode(Ident id) : ASTLocationNode(AST_VAR_LOCATION, false), var_(id) {}
+		Ident getVar() const {
 			return var_;
 		}
 		Value *accept(Visitor *) override;
 
 	private:
-		string var_;
+		Ident var_;
 };
 
 class ASTArrayLocationNode : public ASTLocationNode {
 	public:
-		ASTArrayLocationNode(string id, ASTExpressionNode *ex) : var_(id), expr_(ex), ASTLocationNode(true) {}
-		const string getVar() const {
+		ASTArrayLocationNode(Ident id, ASTExpressionNode *ex) : ASTLocationNode(AST_ARRAY_LOCATION, true), var_(id), expr_(ex) {}
+		Ident getVar() const {
 			return var_;
 		}
 		ASTExpressionNode *getExpression() const {
 			return expr_;
 		}
+		void setExpression(ASTExpressionNode *ex) {
+			expr_ = ex;
+		}
 		Value *accept(Visitor *) override;
 
 	private:
-		string var_;
+		Ident var_;
 		ASTExpressionNode *expr_;
 };
 
 class ASTExpressionCalloutArg : public ASTCalloutArg {
 	public:
-		ASTExpressionCalloutArg(ASTExpressionNode *ex) {
+		ASTExpressionCalloutArg(ASTExpressionNode *ex) : ASTCalloutArg(AST_EXPRESSION_CALLOUT_ARG) {
 			expr_ = ex;
 		}
 		ASTExpressionNode *getExpression() const {
 			return expr_;
 		}
+		void setExpression(ASTExpressionNode *ex) {
+			expr_ = ex;
+		}
 		Value *accept(Visitor *) override;
 
 	private:
@@ -440,21 +552,21 @@ class ASTExpressionCalloutArg : public ASTCalloutArg {
 
 class ASTStringCalloutArg : public ASTCalloutArg {
 	public:
-		ASTStringCalloutArg(string arg) {
+		ASTStringCalloutArg(StringRef arg) : ASTCalloutArg(AST_STRING_CALLOUT_ARG) {
 			arg_ = arg;
 		}
-		string getString() const {
+		StringRef getString() const {
 			return arg_;
 		}
 		Value *accept(Visitor *) override;
 
 	private:
-		string arg_;
+		StringRef arg_;
 };
 
 class ASTMethodCallExpressionNode : public ASTExpressionNode {
 	public:
-		ASTMethodCallExpressionNode(ASTMethodCallStatementNode *method) : ASTExpressionNode() {
+		ASTMethodCallExpressionNode(ASTMethodCallStatementNode *method) : ASTExpressionNode(AST_METHOD_CALL_EXPRESSION) {
 			methodNode_ = method;
 		}
 		ASTMethodCallStatementNode *getMethodCallStatement() {
@@ -468,7 +580,7 @@ class ASTMethodCallExpressionNode : public ASTExpressionNode {
 
 class ASTIntegerLiteralExpressionNode : public ASTExpressionNode {
 	public:
-		ASTIntegerLiteralExpressionNode(int val) : ASTExpressionNode() {
+		ASTIntegerLiteralExpressionNode(int val) : ASTExpressionNode(AST_INTEGER_LITERAL) {
 			value_ = val;
 		}
 		int getValue() const {
@@ -482,7 +594,7 @@ class ASTIntegerLiteralExpressionNode : public ASTExpressionNode {
 
 class ASTCharLiteralExpressionNode : public ASTExpressionNode {
 	public:
-		ASTCharLiteralExpressionNode(char val) : ASTExpressionNode() {
+		ASTCharLiteralExpressionNode(char val) : ASTExpressionNode(AST_CHAR_LITERAL) {
 			value_ = val;
 		}
 		char getValue() const {
@@ -496,21 +608,21 @@ class ASTCharLiteralExpressionNode : public ASTExpressionNode {
 
 class ASTBoolLiteralExpressionNode : public ASTExpressionNode {
 	public:
-		ASTBoolLiteralExpressionNode(string val) : ASTExpressionNode() {
+		ASTBoolLiteralExpressionNode(bool val) : ASTExpressionNode(AST_BOOL_LITERAL) {
 			value_ = val;
 		}
-		string getValue() const {
+		bool getValue() const {
 			return value_;
 		}
 		Value *accept(Visitor *) override;
 
 	private:
-		string value_;
+		bool value_;
 };
 
 class ASTLocationExpressionNode : public ASTExpressionNode {
 	public:
-		ASTLocationExpressionNode(ASTLocationNode *loc) : ASTExpressionNode() {
+		ASTLocationExpressionNode(ASTLocationNode *loc) : ASTExpressionNode(AST_LOCATION_EXPRESSION) {
 			location_ = loc;
 		}
 		ASTLocationNode *getLocation() const {
@@ -524,20 +636,8 @@ class ASTLocationExpressionNode : public ASTExpressionNode {
 
 class ASTBinaryExpressionNode : public ASTExpressionNode {
 	public:
-		ASTBinaryExpressionNode(ASTExpressionNode *L, ASTExpressionNode *R, string op) : ASTExpressionNode(L, R) {
-			((!op.compare("*")) ? operator_ = _mult :
-			((!op.compare("/")) ? operator_ = _div  :
-			((!op.compare("+")) ? operator_ = _plus :
-			((!op.compare("-")) ? operator_ = _minus :
-			((!op.compare("%")) ? operator_ = _mod :
-			((!op.compare("==")) ? operator_ = _eq :
-			((!op.compare("!=")) ? operator_ = _neq :
-			((!op.compare("&&")) ? operator_ = _and :
-			((!op.compare("||")) ? operator_ = _or :
-			((!op.compare(">")) ? operator_ = _gt :
-			((!op.compare("<")) ? operator_ = _lt :
-			((!op.compare(">=")) ? operator_ = _gteq :
-			((!op.compare("<=")) ? operator_ = _lteq : operator_ = _error)))))))))))));
+		ASTBinaryExpressionNode(ASTExpressionNode *L, ASTExpressionNode *R, int op) : ASTExpressionNode(AST_BINARY_EXPRESSION, L, R) {
+			operator_ = op;
 		}
 		const int getOperatorId() const {
 			return operator_;
@@ -550,9 +650,8 @@ class ASTBinaryExpressionNode : public ASTExpressionNode {
 
 class ASTUnaryExpressionNode : public ASTExpressionNode {
 	public:
-		ASTUnaryExpressionNode(ASTExpressionNode *R, string op) : ASTExpressionNode(NULL, R) {
-			((!op.compare("-")) ? operator_ = _unaryminus :
-			((!op.compare("!")) ? operator_ = _negate : operator_ = _error));
+		ASTUnaryExpressionNode(ASTExpressionNode *R, int op) : ASTExpressionNode(AST_UNARY_EXPRESSION, NULL, R) {
+			operator_ = op;
 		}
 		const int getOperatorId() const {
 			return operator_;
@@ -591,8 +690,92 @@ class Visitor {
 		virtual Value *visit(ASTUnaryExpressionNode *) = 0;
 };
 
-class EvaluateVisitor : public Visitor {
+/*
+ * Base for visitors that dispatch on the node kind instead of through
+ * accept(). Derived is the visitor itself (CRTP): dispatch() switches on
+ * getKind() and calls Derived::visit for the concrete class directly, so
+ * there is no virtual call per node. Derived must have a visit method for
+ * every concrete node class, returning RetTy.
+ */
+template <typename Derived, typename RetTy = Value *>
+class ASTVisitorBase {
+	public:
+		RetTy dispatch(ASTNode *node) {
+			Derived *self = static_cast<Derived *>(this);
+			switch(node->getKind()) {
+			case AST_PROGRAM:
+				return self->visit(static_cast<ASTProgramNode *>(node));
+			case AST_METHOD_DECL:
+				return self->visit(static_cast<ASTMethodDeclNode *>(node));
+			case AST_BLOCK:
+				return self->visit(static_cast<ASTBlock *>(node));
+			case AST_BLOCK_STATEMENT:
+				return self->visit(static_cast<ASTBlockStatementNode *>(node));
+			case AST_ASSIGNMENT_STATEMENT:
+				return self->visit(static_cast<ASTAssignmentStatementNode *>(node));
+			case AST_SIMPLE_METHOD_CALL:
+				return self->visit(static_cast<ASTSimpleMethodCallNode *>(node));
+			case AST_CALLOUT_METHOD_CALL:
+				return self->visit(static_cast<ASTCalloutMethodCallNode *>(node));
+			case AST_IF_STATEMENT:
+				return self->visit(static_cast<ASTIfStatementDeclNode *>(node));
+			case AST_FOR_STATEMENT:
+				return self->visit(static_cast<ASTForStatementDeclNode *>(node));
+			case AST_RETURN_STATEMENT:
+				return self->visit(static_cast<ASTReturnStatementNode *>(node));
+			case AST_BREAK_STATEMENT:
+				return self->visit(static_cast<ASTBreakStatementNode *>(node));
+			case AST_CONTINUE_STATEMENT:
+				return self->visit(static_cast<ASTContinueStatementNode *>(node));
+			case AST_VAR_LOCATION:
+				return self->visit(static_cast<ASTVarLocationNode *>(node));
+			case AST_ARRAY_LOCATION:
+				return self->visit(static_cast<ASTArrayLocationNode *>(node));
+			case AST_EXPRESSION_CALLOUT_ARG:
+				return self->visit(static_cast<ASTExpressionCalloutArg *>(node));
+			case AST_STRING_CALLOUT_ARG:
+				return self->visit(static_cast<ASTStringCalloutArg *>(node));
+			case AST_METHOD_CALL_EXPRESSION:
+				return self->visit(static_cast<ASTMethodCallExpressionNode *>(node));
+			case AST_INTEGER_LITERAL:
+				return self->visit(static_cast<ASTIntegerLiteralExpressionNode *>(node));
+			case AST_CHAR_LITERAL:
+				return self->visit(static_cast<ASTCharLiteralExpressionNode *>(node));
+			case AST_BOOL_LITERAL:
+				return self->visit(static_cast<ASTBoolLiteralExpressionNode *>(node));
+			case AST_LOCATION_EXPRESSION:
+				return self->visit(static_cast<ASTLocationExpressionNode *>(node));
+			case AST_BINARY_EXPRESSION:
+				return self->visit(static_cast<ASTBinaryExpressionNode *>(node));
+			case AST_UNARY_EXPRESSION:
+				return self->visit(static_cast<ASTUnaryExpressionNode *>(node));
+			}
+			return RetTy();
+		}
+};
+
+struct Loop;
+class LoopBodyScan;
+struct Builtin;
+
+/*
+ * Generates the IR of a program into a module. All of the codegen state
+ * (builder, scopes, loops) lives in the visitor, so visitors on different
+ * threads can work on modules of different LLVMContexts at the same time.
+ * The visitor that owns the fields defines them; any other only declares
+ * them, to be resolved when its module is linked with the owner's.
+ */
+class EvaluateVisitor : public ASTVisitorBase<EvaluateVisitor> {
 	public:
+		EvaluateVisitor(Module *M, bool ownsFields)
+			: context_(M->getContext()), module_(M), builder_(M->getContext()),
+			  ownsFields_(ownsFields), declStarted_(false), recurseBB_(nullptr) {}
+
+		/* Declares the fields and methods, and defines methods [first, last) */
+		void generate(ASTProgramNode *node, unsigned first, unsigned last);
+		/* Type errors found while generating, in program order. The module is then unusable */
+		const vector<string> &errors() const { return errors_; }
+
 		Value *visit(ASTAssignmentStatementNode *node);
 		Value *visit(ASTVarLocationNode *node);
 		Value *visit(ASTArrayLocationNode *node);
@@ -612,23 +795,129 @@ class EvaluateVisitor : public Visitor {
 		Value *visit(ASTMethodCallExpressionNode *node);
 		Value *visit(ASTIntegerLiteralExpressionNode *node);
 		Value *visit(ASTBoolLiteralExpressionNode *node);
-		Value *visit(ASTCharLiteralExpressionNode *node) {}
+		Value *visit(ASTCharLiteralExpressionNode *node);
 		Value *visit(ASTLocationExpressionNode *node);
 		Value *visit(ASTBinaryExpressionNode *node);
 		Value *visit(ASTUnaryExpressionNode *node);
+
+	private:
+		void error(const string &message);
+		void declareFields(const ASTArray<ASTFieldDecl *> &fields);
+		void declareMethods(const ASTArray<ASTMethodDeclNode *> &methods);
+		void annotateSymbolTable(int datatype, const ASTArray<Symbol *> &variableList);
+		AllocaInst *defineVariable(Type *llvmTy, Value *v, StringRef id);
+		Value *toCondition(Value *v);
+		void emitBranch(ASTExpressionNode *cond, BasicBlock *trueBB, BasicBlock *falseBB);
+		Value *emitLogical(ASTBinaryExpressionNode *node);
+		bool isLoopInvariant(ASTExpressionNode *e, Ident it, const LoopBodyScan &scan);
+		void emitLoop(ASTForStatementDeclNode *node, Value *init, CmpInst::Predicate pred,
+					  Value *bound, const LoopBodyScan &scan);
+		void emitParallelFor(ASTForStatementDeclNode *node, Value *init, CmpInst::Predicate pred,
+							 Value *bound, const LoopBodyScan &scan);
+
+		Value *emitBuiltin(ASTSimpleMethodCallNode *node, const Builtin *b);
+		Value *callKernel(StringRef name, Type *ret, ArrayRef<Value *> args, bool readOnly);
+		Constant *getFunction(StringRef name, FunctionType *FT);
+		Constant *getString(StringRef s);
+
+		unsigned newVariable(Type *ty, StringRef name);
+		void writeVariable(unsigned var, BasicBlock *BB, Value *v);
+		Value *readVariable(unsigned var, BasicBlock *BB);
+		Value *readVariableRecursive(unsigned var, BasicBlock *BB);
+		Value *addPhiOperands(unsigned var, PHINode *phi);
+		Value *removeTrivialPhi(PHINode *phi);
+		void sealBlock(BasicBlock *BB);
+		void startBlock(BasicBlock *BB);
+
+		LLVMContext &context_;
+		Module *module_;
+		IRBuilder<> builder_;
+		ScopedSymbolTable symTable_;
+		map<Ident, Function *> methodTable_;
+		stack<Loop *> loops_;
+		bool ownsFields_;
+		bool declStarted_;			// Set once the fields of the program are declared
+		StringMap<Constant *> functions_;	// External functions declared in the module, by name
+		StringMap<Constant *> strings_;		// String constants of the module, by contents
+		vector<string> errors_;
+
+		/* SSA construction of the scalar locals and parameters of the method */
+		struct Variable {
+			Type *type;
+			StringRef name;
+		};
+		vector<Variable> variables_;
+		map<pair<BasicBlock *, unsigned>, TrackingVH<Value> > currentDef_;	// Value of a variable at the end of a block
+		map<BasicBlock *, vector<pair<unsigned, PHINode *> > > incompletePhis_;	// Phis of blocks not sealed yet
+		set<BasicBlock *> sealed_;			// Blocks whose predecessors are all known
+		set<PHINode *> variablePhis_;		// Phis placed by the construction, once they have all their operands
+		set<Ident> sharedVars_;				// Names assigned in a parallel loop, kept in memory
+
+		/* Self tail calls of the method, which jump back to recurseBB_ */
+		BasicBlock *recurseBB_;
+		vector<pair<int, AllocaInst *> > params_;	// SSA variable, or stack slot, of each parameter
 };
 
 /* Variable encountered in the FieldDecl rule is stored as a Symbol */
 class Symbol {
 	public:
-		Symbol(string id) : id_(id), literal_(NULL) {}
-		Symbol(string id, ASTIntegerLiteralExpressionNode* lit) : id_(id), literal_(lit) {}
+		Symbol(Ident id) : id_(id), literal_(NULL) {}
+		Symbol(Ident id, ASTIntegerLiteralExpressionNode* lit) : id_(id), literal_(lit) {}
 
-		string id_;
+		Ident id_;
 		ASTIntegerLiteralExpressionNode *literal_;
 };
 
-void annotateSymbolTable(int datatype, list<Symbol *> *variableList);
-void BuildIR(ASTProgramNode *root);
+/* Numbers and names of the classes allocated in the session, for --mem-report */
+#define ARENA_TYPE(T, ID) \
+	template <> struct ArenaType<T> { \
+		static const unsigned id = ID; \
+		static const char *name() { \
+			return #T; \
+		} \
+	};
+ARENA_TYPE(ASTProgramNode, AST_PROGRAM)
+ARENA_TYPE(ASTMethodDeclNode, AST_METHOD_DECL)
+ARENA_TYPE(ASTBlock, AST_BLOCK)
+ARENA_TYPE(ASTBlockStatementNode, AST_BLOCK_STATEMENT)
+ARENA_TYPE(ASTAssignmentStatementNode, AST_ASSIGNMENT_STATEMENT)
+ARENA_TYPE(ASTSimpleMethodCallNode, AST_SIMPLE_METHOD_CALL)
+ARENA_TYPE(ASTCalloutMethodCallNode, AST_CALLOUT_METHOD_CALL)
+ARENA_TYPE(ASTIfStatementDeclNode, AST_IF_STATEMENT)
+ARENA_TYPE(ASTForStatementDeclNode, AST_FOR_STATEMENT)
+ARENA_TYPE(ASTReturnStatementNode, AST_RETURN_STATEMENT)
+ARENA_TYPE(ASTBreakStatementNode, AST_BREAK_STATEMENT)
+ARENA_TYPE(ASTContinueStatementNode, AST_CONTINUE_STATEMENT)
+ARENA_TYPE(ASTVarLocationNode, AST_VAR_LOCATION)
+ARENA_TYPE(ASTArrayLocationNode, AST_ARRAY_LOCATION)
+ARENA_TYPE(ASTExpressionCalloutArg, AST_EXPRESSION_CALLOUT_ARG)
+ARENA_TYPE(ASTStringCalloutArg, AST_STRING_CALLOUT_ARG)
+ARENA_TYPE(ASTMethodCallExpressionNode, AST_METHOD_CALL_EXPRESSION)
+ARENA_TYPE(ASTIntegerLiteralExpressionNode, AST_INTEGER_LITERAL)
+ARENA_TYPE(ASTCharLiteralExpressionNode, AST_CHAR_LITERAL)
+ARENA_TYPE(ASTBoolLiteralExpressionNode, AST_BOOL_LITERAL)
+ARENA_TYPE(ASTLocationExpressionNode, AST_LOCATION_EXPRESSION)
+ARENA_TYPE(ASTBinaryExpressionNode, AST_BINARY_EXPRESSION)
+ARENA_TYPE(ASTUnaryExpressionNode, AST_UNARY_EXPRESSION)
+ARENA_TYPE(Symbol, ARENA_SYMBOL)
+ARENA_TYPE(ASTFieldDecl, ARENA_FIELD_DECL)
+ARENA_TYPE(ASTParameterDecl, ARENA_PARAMETER_DECL)
+#undef ARENA_TYPE
+
+static_assert(NUM_ARENA_TYPES <= CompilationSession::MaxArenaTypes, "Too many classes allocated in the session");
+
+class CompileCache;
+struct PhaseTime;
+
+/*
+ * Generates the IR of the program into a new module of the given context,
+ * on up to jobs threads. With a cache, the IR of every method is reused
+ * from it if the method has not changed. Type errors are reported on
+ * stderr, prefixed with fileName; they make this return nullptr, as do
+ * parts that cannot be merged. The CPU time of the threads it starts (none
+ * for a single job) is stored in *workerTimes, if given.
+ */
+Module *BuildIR(ASTProgramNode *root, const char *fileName, unsigned jobs, LLVMContext &Context,
+				CompileCache *cache = nullptr, PhaseTime *workerTimes = nullptr);
 
 #endif
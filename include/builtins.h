@@ -0,0 +1,42 @@
+#ifndef __BUILTINS_H__
+#define __BUILTINS_H__
+
+#include <llvm/ADT/StringRef.h>
+
+/*
+ * Methods on whole arrays that any program can call without declaring
+ * them. Their names are taken before the methods of the program, which may
+ * not declare methods of the same names. The arrays are passed by name, and
+ * the compiler knows their lengths; the work is done by the SIMD kernels of
+ * the runtime library.
+ *
+ *   array_sum(a)       sum of the elements (of a boolean array : the trues)
+ *   array_min(a)       least element (boolean : whether all are true)
+ *   array_max(a)       greatest element (boolean : whether any is true)
+ *   array_fill(a, v)   sets every element to v
+ *   array_copy(a, b)   copies b into a, over the shorter of the two
+ *   array_count(a, v)  number of elements equal to v
+ *   array_dot(a, b)    sum of a[i] * b[i] over the shorter of the two
+ */
+enum BuiltinKind {
+	BUILTIN_SUM,
+	BUILTIN_MIN,
+	BUILTIN_MAX,
+	BUILTIN_FILL,
+	BUILTIN_COPY,
+	BUILTIN_COUNT,
+	BUILTIN_DOT
+};
+
+struct Builtin {
+	const char *name;
+	BuiltinKind kind;
+	unsigned arrays;		// Leading arguments that name arrays
+	unsigned args;
+	bool writes;			// Whether it assigns the first array
+};
+
+/* The builtin of that name, or nullptr */
+const Builtin *findBuiltin(llvm::StringRef name);
+
+#endif
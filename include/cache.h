@@ -0,0 +1,64 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <string>
+#include <iostream>
+#include <mutex>
+#include <stdint.h>
+#include <llvm/ADT/StringRef.h>
+using namespace std;
+using namespace llvm;
+
+/*
+ * On-disk cache of compiler outputs (bitcode, objects, assembly), keyed by
+ * a hash of the source bytes, the compiler build and the options that
+ * change the output. On a hit the cached file is copied to the output and
+ * the file is not compiled at all.
+ *
+ * The cache is safe to share between concurrent compiles, in this process
+ * or in others : entries are written to a temporary file and renamed into
+ * place, and the statistics and eviction are serialized by a lock file.
+ * Every hit refreshes the modification time of its entry, and when the
+ * entries grow past the size limit the least recently used are removed.
+ * The counters are kept in memory until flushStats(), so that a lookup
+ * does not have to take the lock.
+ */
+class CompileCache {
+	public:
+		CompileCache(const string &dir, uint64_t maxBytes);
+
+		/* The key of compiling source with the options described by flags */
+		string computeKey(const string &source, const string &flags) const;
+		/* Copies the entry for key to output. Returns false on a miss */
+		bool lookup(const string &key, const string &output);
+		/* Adds output as the entry for key */
+		void store(const string &key, const string &output);
+		/* The same for data held in memory */
+		bool lookupBlob(const string &key, string &data);
+		void storeBlob(const string &key, StringRef data);
+		/* Adds the counts of this process to the statistics, evicting old entries if needed */
+		void flushStats();
+		/* Prints the hit and miss counts and the size of the cache */
+		void printStats(ostream &os);
+
+		/* $DECAF_CACHE_DIR, else $XDG_CACHE_HOME/decaf or ~/.cache/decaf */
+		static string defaultDirectory();
+
+	private:
+		struct Stats {
+			uint64_t hits, misses, stores, evictions, bytes;
+		};
+		string entryPath(const string &key) const;
+		Stats updateStats(const Stats &delta);
+		uint64_t evict(uint64_t *bytes);
+
+		Stats flushPending();
+
+		string dir_;
+		uint64_t maxBytes_;
+		string compiler_;			// Identifies the build of decaf
+		mutex lock_;				// Guards pending_
+		Stats pending_;				// Counts not yet added to the statistics file
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef __DRIVER_H__
+#define __DRIVER_H__
+
+#include <cstdio>
+#include <string>
+#include "stdllvm.h"
+#include "cache.h"
+#include "timing.h"
+#include "memreport.h"
+using namespace std;
+using namespace llvm;
+
+// What the compiler writes for the input file
+enum OutputKind { EMIT_BITCODE, EMIT_OBJECT, EMIT_ASSEMBLY, EMIT_EXECUTABLE, RUN_JIT };
+
+// How an input file is compiled
+struct CompileOptions
+{
+    int optLevel;
+    string pipeline;
+    OutputKind emit;
+    unsigned jobs;              // Threads generating the IR of one file
+    TargetMachine *target;      // Host target for optLevel, kept by the caller. If NULL, one is made per file
+    CompileCache *cache;        // Cache of outputs, or NULL
+    bool incremental;           // Also cache the IR of every method, and only generate the changed ones
+    bool wholeProgram;          // Internalize the methods and infer their attributes (--whole-program)
+};
+
+// Name the diagnostics are prefixed with (argv[0])
+extern const char *ProgName;
+
+// Extension of the output written next to the input ("" for --run)
+const char *DefaultExtension(OutputKind emit);
+
+/*
+ * Compiles the Decaf program read from in. name is the file name used in
+ * diagnostics. Everything the compilation uses (the session, the
+ * LLVMContext and, unless opts.target is given, the target machine)
+ * belongs to it, so several files can be compiled at once on different
+ * threads. Errors are reported on stderr and make this return false; they
+ * never end the process. For --run, *exitCode is set to the value main()
+ * returned. If times is given, the time of every phase is added to it,
+ * and if mem is, the memory the compilation used is recorded in it.
+ */
+bool CompileStream(FILE *in, const string &name, const string &output, const CompileOptions &opts, int *exitCode,
+                   TimeReport *times = NULL, MemReport *mem = NULL);
+
+/*
+ * CompileStream on the file at input. With a cache, bitcode, object and
+ * assembly outputs are looked up in it first, and stored in it when the
+ * file had to be compiled. With opts.incremental, a file that has to be
+ * compiled reuses the IR of its unchanged methods from the cache.
+ */
+bool CompileFile(const string &input, const string &output, const CompileOptions &opts, int *exitCode,
+                 TimeReport *times = NULL, MemReport *mem = NULL);
+
+#endif
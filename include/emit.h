@@ -0,0 +1,45 @@
+#ifndef __EMIT_H__
+#define __EMIT_H__
+
+#include <string>
+#include <vector>
+#include "stdllvm.h"
+using namespace std;
+using namespace llvm;
+
+/* Maps a -O<n> level to the code generator's optimization level */
+CodeGenOpt::Level GetCodeGenOptLevel(int level);
+
+/*
+ * Creates a TargetMachine for the host triple and CPU, with code
+ * generation tuned for the given -O level. Returns nullptr (after
+ * printing the reason) if the host target is not available.
+ */
+TargetMachine *CreateHostTargetMachine(int level);
+
+/*
+ * Triple, CPU and features of the host target, i.e. everything that makes
+ * CreateHostTargetMachine generate different code on different machines.
+ */
+string DescribeHostTarget();
+
+/*
+ * Sets the module's triple and data layout from the target machine.
+ * Must be done before the optimizer runs so that it sees the target.
+ */
+void PrepareModuleForTarget(Module *M, TargetMachine *TM);
+
+/*
+ * Emits the module as a native object file (or assembly, if assembly
+ * is true) to the given path. Returns false on failure.
+ */
+bool EmitNativeFile(Module *M, TargetMachine *TM, const string &out, bool assembly);
+
+/*
+ * Links the object files into an executable using the system C compiler
+ * driver, so that the C library (printf etc.) is pulled in, together with
+ * the runtime library found next to the compiler and pthreads.
+ */
+bool LinkExecutable(const vector<string> &objects, const string &out);
+
+#endif
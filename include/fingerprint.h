@@ -0,0 +1,19 @@
+#ifndef __FINGERPRINT_H__
+#define __FINGERPRINT_H__
+
+#include <string>
+#include <vector>
+#include "ast.h"
+using namespace std;
+
+/*
+ * Structural fingerprint of every method of the program, in program order.
+ * Two methods have the same fingerprint exactly when the IR generated for
+ * them is the same : it covers the method's own AST (node kinds, operators,
+ * literals and names, not source positions or handles), the declarations
+ * of the fields it names and the signatures of the methods it calls.
+ * Names are read from the Session of the calling thread.
+ */
+void FingerprintMethods(ASTProgramNode *root, vector<string> &fingerprints);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef __FOLD_H__
+#define __FOLD_H__
+
+#include "ast.h"
+
+/*
+ * Simplifies the expressions of the program in place, before any IR is
+ * generated : operators on literals are computed, identities such as x * 1,
+ * x + 0 and !!b are dropped, and multiplication, division and remainder by
+ * powers of two become shifts and masks. Signed semantics are kept (the
+ * division truncates towards zero), and an operand with a method call in it
+ * is never dropped or evaluated twice. New nodes are made in the Session of
+ * the calling thread.
+ */
+void FoldConstants(ASTProgramNode *root);
+
+#endif
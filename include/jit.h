@@ -0,0 +1,22 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include "stdllvm.h"
+using namespace llvm;
+
+/* Time spent in the two halves of a --run */
+struct JITTimes {
+	double codegenSeconds;			// Machine code generation and linking in memory
+	double runSeconds;				// Execution of the Decaf main()
+};
+
+/*
+ * Compiles the module in memory with MCJIT and calls its main method.
+ * External symbols (callout targets such as printf) are resolved against
+ * the running process. The execution engine takes ownership of the module.
+ * The value returned by main (0 for a void or boolean main) is stored in
+ * exitCode. Returns false if the module could not be compiled.
+ */
+bool RunModuleJIT(Module *M, int level, int *exitCode, JITTimes *times);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __MEMREPORT_H__
+#define __MEMREPORT_H__
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include "session.h"
+#include "stdllvm.h"
+using namespace std;
+using namespace llvm;
+
+/* Size of an LLVM module */
+struct ModuleSize {
+	unsigned functions, globals, blocks, instructions;
+};
+
+/*
+ * Memory used to compile one file (--mem-report). The session's figures
+ * are taken just before it is released, once the IR has been built.
+ */
+struct MemReport {
+	MemReport() : recorded(false), hasModule(false), hasOptimized(false) {}
+
+	string file;
+	bool recorded;					// The file got as far as parsing
+	vector<ArenaUsage> classes;		// Classes allocated in the session, most bytes first
+	size_t arenaBytes;				// Everything the session's arena holds, with its slack
+	size_t listBytes;				// Child arrays of the nodes
+	size_t stringBytes;				// String literals copied by the lexer
+	size_t identifierBytes;			// Identifier table
+	unsigned identifiers;
+	bool hasModule, hasOptimized;
+	ModuleSize module;				// As generated
+	ModuleSize optimized;			// After the optimizer
+};
+
+/* Takes the counts of what the session has allocated */
+void RecordSessionMemory(const CompilationSession *session, MemReport *report);
+
+/* Counts the functions, globals, basic blocks and instructions of the module */
+void RecordModuleSize(const Module *M, ModuleSize *size);
+
+/* Prints the reports, followed by the peak resident set size of the process */
+void PrintMemReport(ostream &os, const vector<MemReport> &reports);
+
+#endif
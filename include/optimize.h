@@ -0,0 +1,25 @@
+#ifndef __OPTIMIZE_H__
+#define __OPTIMIZE_H__
+
+#include <string>
+#include "stdllvm.h"
+using namespace std;
+using namespace llvm;
+
+/*
+ * Verifies the module, printing any problems to stderr.
+ * Returns true if the module is well formed.
+ */
+bool VerifyIR(Module *M);
+
+/*
+ * Runs the optimization pipeline over the module. The level is the
+ * value given with -O<n> (0 - 3). If pipeline is not empty, it is a comma
+ * separated list of pass names (see -passes=) that replaces the pipeline
+ * picked by the level. If TM is given, its target information is made
+ * available to the passes (cost models used by the vectorizers etc.).
+ * Returns false if a pass name is unknown.
+ */
+bool OptimizeModule(Module *M, int level, const string &pipeline, TargetMachine *TM = nullptr);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef __PARSER_H__
+#define __PARSER_H__
+
+#include <cstdio>
+#include "ast.h"
+
+/*
+ * State of one parse, reachable from the scanner (yyextra) and from the
+ * parser actions. Scanner and parser are reentrant, so several files can
+ * be parsed at the same time on different threads.
+ */
+struct ParseState {
+	const char *fileName;			// Used to prefix the diagnostics
+	ASTProgramNode *root;
+	int errors;
+};
+
+/*
+ * Parses the Decaf program read from in. The AST is allocated in the
+ * Session of the calling thread. Syntax errors are reported on stderr and
+ * make this return nullptr; they do not end the process.
+ */
+ASTProgramNode *ParseProgram(FILE *in, const char *fileName);
+
+/*
+ * Runs only the scanner over the program read from in, for timing the
+ * lexer on its own. Token text is copied into the Session of the calling
+ * thread, as it is when parsing. Returns the number of tokens.
+ */
+int ScanProgram(FILE *in, const char *fileName);
+
+#endif
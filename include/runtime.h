@@ -0,0 +1,52 @@
+#ifndef __RUNTIME_H__
+#define __RUNTIME_H__
+
+/*
+ * Runtime library of the programs the compiler generates (libdecafrt.a).
+ * It is plain C on top of pthreads, so that the programs link with the
+ * system cc and nothing else.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Runs body(ctx, lo, hi) on chunks [lo, hi] that cover the iterations
+ * [first, last] exactly once, on a pool of threads started on first use,
+ * and returns once all the iterations are done. The pool has a thread per
+ * online processor, or $DECAF_NUM_THREADS. A loop started while another
+ * one is running on the pool (a nested parallel loop) runs its iterations
+ * on the calling thread.
+ */
+void __decaf_parallel_for(void (*body)(void *ctx, int lo, int hi), void *ctx, int first, int last);
+
+/*
+ * Buffered output, which callouts to printf with a constant format are
+ * lowered to. Each thread appends to a buffer of its own, written to stdout
+ * when full, by __decaf_flush and at exit. The writers return the number of
+ * characters written, as printf does.
+ */
+int __decaf_write_str(const char *s, int len);
+int __decaf_write_int(int v);
+int __decaf_write_char(int c);
+void __decaf_flush(void);
+
+/*
+ * Kernels of the array builtins, over the first n elements of arrays of
+ * ints or of booleans (one byte each, 0 or 1). The min of no elements is
+ * INT_MAX and the max INT_MIN. Sums and dot products wrap around.
+ */
+int __decaf_array_sum(const int *a, int n);
+int __decaf_array_min(const int *a, int n);
+int __decaf_array_max(const int *a, int n);
+void __decaf_array_fill(int *a, int n, int v);
+int __decaf_array_count(const int *a, int n, int v);
+int __decaf_array_dot(const int *a, const int *b, int n);
+int __decaf_array_count_bool(const unsigned char *a, int n, int v);
+int __decaf_array_dot_bool(const unsigned char *a, const unsigned char *b, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
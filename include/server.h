@@ -0,0 +1,44 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <string>
+#include "driver.h"
+using namespace std;
+
+/*
+ * Compile server. `decaf --server` listens on a Unix domain socket and
+ * compiles the files sent by `decaf --client`, which saves every compile
+ * the start up of the process and the initialization of LLVM : the server
+ * registers the target and builds the target machines once, and each
+ * request is compiled in a child forked from that warm state. Requests are
+ * served concurrently, and a crash while compiling one does not take the
+ * server down.
+ *
+ * Protocol : one request per connection. The client sends lines of the
+ * form "key value" and an empty line :
+ *
+ *   opt N         -O level
+ *   emit KIND     bc, o, s or out
+ *   passes LIST   as -passes=
+ *   whole-program as --whole-program (no value)
+ *   name NAME     file name to use in diagnostics
+ *   path FILE     compile this file, or
+ *   size N        compile the N bytes of source that follow the empty line
+ *
+ * The server answers "ok N" followed by the N bytes of the output, or
+ * "error N" followed by N bytes of diagnostics, and closes the connection.
+ */
+
+// $XDG_RUNTIME_DIR/decaf.sock, or /tmp/decaf-<uid>.sock
+string DefaultSocketPath();
+
+// Serves requests until killed. jobs is the -j of every compile
+int RunServer(const string &socketPath, unsigned jobs);
+
+/*
+ * Has the server compile input (a path, or "-" for standard input) and
+ * writes the result to output. Returns the exit status for the client.
+ */
+int RunClient(const string &socketPath, const string &input, const string &output, const CompileOptions &opts);
+
+#endif
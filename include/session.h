@@ -0,0 +1,156 @@
+#ifndef __SESSION_H__
+#define __SESSION_H__
+
+#include <cstring>
+#include <utility>
+#include <vector>
+#include <llvm/ADT/StringMap.h>
+#include "arena.h"
+using namespace std;
+using namespace llvm;
+
+/*
+ * Handle of an interned identifier. Every distinct name in the program
+ * is stored once, so two identifiers are the same name exactly when their
+ * handles are equal.
+ */
+typedef unsigned Ident;
+
+/*
+ * Number and name under which the objects of class T are counted by the
+ * session, for --mem-report. Every class allocated with make() specializes
+ * it (see the end of ast.h).
+ */
+template <typename T> struct ArenaType;
+
+/* The objects of one class allocated in a session */
+struct ArenaUsage {
+	const char *name;
+	size_t count, bytes;
+};
+
+/*
+ * State owned by one compilation. All AST nodes, their child arrays and
+ * the token text handed out by the lexer are allocated from the session's
+ * arena, and are released in one shot when the session is destroyed.
+ * Nothing allocated here has its destructor run. The session also owns
+ * the identifier table, and counts what it allocates, by class.
+ */
+class CompilationSession {
+	public:
+		static const unsigned MaxArenaTypes = 32;
+
+		CompilationSession() : stringBytes_(0), listBytes_(0) {
+			for(unsigned i = 0; i < MaxArenaTypes; i++) {
+				usage_[i].name = nullptr;
+				usage_[i].count = usage_[i].bytes = 0;
+			}
+		}
+		~CompilationSession() {
+			for(unsigned i = 0; i < builders_.size(); i++) {
+				delete builders_[i];
+			}
+		}
+
+		template <typename T, typename... Args>
+		T *make(Args&&... args) {
+			void *mem = allocator_.Allocate(sizeof(T), alignof(T));
+			ArenaUsage &usage = usage_[ArenaType<T>::id];
+			usage.name = ArenaType<T>::name();
+			usage.count++;
+			usage.bytes += sizeof(T);
+			return new (mem) T(std::forward<Args>(args)...);
+		}
+		/* An empty builder for a list production */
+		ListBuilder *newListBuilder() {
+			if(freeBuilders_.empty()) {
+				builders_.push_back(new ListBuilder());
+				return builders_.back();
+			}
+			ListBuilder *b = freeBuilders_.back();
+			freeBuilders_.pop_back();
+			return b;
+		}
+		/*
+		 * Copies a finished list into the arena and recycles its builder.
+		 * T is the element type that was pushed into the builder.
+		 */
+		template <typename T>
+		ASTArray<T *> finishList(ListBuilder *b) {
+			unsigned n = b->size();
+			T **mem = nullptr;
+			if(n) {
+				mem = static_cast<T **>(allocator_.Allocate(n * sizeof(T *), alignof(T *)));
+				listBytes_ += n * sizeof(T *);
+				for(unsigned i = 0; i < n; i++) {
+					mem[i] = static_cast<T *>((*b)[i]);
+				}
+			}
+			b->clear();
+			freeBuilders_.push_back(b);
+			return ASTArray<T *>(mem, n);
+		}
+		/* NUL terminated copy of the token text */
+		const char *copyString(const char *s, size_t len) {
+			char *mem = static_cast<char *>(allocator_.Allocate(len + 1, 1));
+			stringBytes_ += len + 1;
+			memcpy(mem, s, len);
+			mem[len] = '\0';
+			return mem;
+		}
+		size_t getBytesAllocated() const {
+			return allocator_.getBytesAllocated();
+		}
+		/* What was allocated for the objects of the class numbered id (see ArenaType) */
+		const ArenaUsage &getUsage(unsigned id) const {
+			return usage_[id];
+		}
+		/* Bytes of token text (string literals) and of child arrays */
+		size_t getStringBytes() const {
+			return stringBytes_;
+		}
+		size_t getListBytes() const {
+			return listBytes_;
+		}
+		/* Bytes held by the identifier table : the names, their entries and the hash table */
+		size_t getIdentifierBytes() const {
+			return identifiers_.getAllocator().getBytesAllocated() +
+				   identifiers_.getNumBuckets() * (sizeof(void *) + sizeof(unsigned)) +
+				   names_.capacity() * sizeof(StringRef);
+		}
+
+		/* Returns the handle of the name, adding it to the table if it is new */
+		Ident intern(const char *s, size_t len) {
+			pair<StringMap<Ident, BumpPtrAllocator>::iterator, bool> res =
+				identifiers_.insert(make_pair(StringRef(s, len), (Ident)names_.size()));
+			if(res.second) {
+				names_.push_back(res.first->getKey());
+			}
+			return res.first->getValue();
+		}
+		StringRef getName(Ident id) const {
+			return names_[id];
+		}
+		unsigned getNumIdentifiers() const {
+			return names_.size();
+		}
+
+	private:
+		BumpPtrAllocator allocator_;
+		StringMap<Ident, BumpPtrAllocator> identifiers_;
+		vector<StringRef> names_;			// Indexed by Ident
+		vector<ListBuilder *> builders_;	// Every builder, for the destructor
+		vector<ListBuilder *> freeBuilders_;
+		ArenaUsage usage_[MaxArenaTypes];	// Indexed by ArenaType<T>::id
+		size_t stringBytes_;
+		size_t listBytes_;
+};
+
+/*
+ * The session of the compilation in progress on this thread, used by the
+ * lexer, parser and code generator. Every file being compiled concurrently
+ * has its own.
+ */
+extern thread_local CompilationSession *Session;
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef __SYMTAB_H__
+#define __SYMTAB_H__
+
+#include <vector>
+#include "session.h"
+#include "stdllvm.h"
+using namespace std;
+using namespace llvm;
+
+/*
+ * Scoped symbol table. Identifiers are interned into small dense handles,
+ * so the table is a vector indexed by Ident holding the innermost binding
+ * of every name: a lookup is a single index. Declaring a name in a scope
+ * remembers the binding it shadows, and leaving the scope restores those
+ * bindings, so popping costs one step per name the scope declared.
+ *
+ * A name is bound either to a Value (the address of a field or an array,
+ * or a value that never changes, like a loop iterator), or to a variable
+ * of the code generator's SSA construction, which has a value of its own
+ * in every basic block.
+ */
+class ScopedSymbolTable {
+	public:
+		ScopedSymbolTable() {}
+
+		void pushScope() {
+			scopes_.push_back(shadowed_.size());
+		}
+		void popScope() {
+			unsigned mark = scopes_.back();
+			scopes_.pop_back();
+			while(shadowed_.size() > mark) {
+				Binding &b = shadowed_.back();
+				bindings_[b.id] = b.entry;
+				shadowed_.pop_back();
+			}
+		}
+		/* Binds id in the innermost scope */
+		void insert(Ident id, Value *v) {
+			bind(id, v, -1);
+		}
+		/* Binds id in the innermost scope to SSA variable var */
+		void insertVariable(Ident id, unsigned var) {
+			bind(id, nullptr, var);
+		}
+		/* Innermost binding of id, or nullptr if it is not declared or is an SSA variable */
+		Value *lookup(Ident id) const {
+			return id < bindings_.size() ? bindings_[id].value : nullptr;
+		}
+		/* SSA variable id is bound to, or -1 */
+		int lookupVariable(Ident id) const {
+			return id < bindings_.size() ? bindings_[id].var : -1;
+		}
+		unsigned getDepth() const {
+			return scopes_.size();
+		}
+
+	private:
+		struct Entry {
+			Value *value;
+			int var;
+		};
+		struct Binding {
+			Ident id;
+			Entry entry;
+		};
+		void bind(Ident id, Value *v, int var) {
+			if(id >= bindings_.size()) {
+				Entry none = { nullptr, -1 };
+				bindings_.resize(id + 1, none);
+			}
+			Binding b = { id, bindings_[id] };
+			shadowed_.push_back(b);
+			bindings_[id].value = v;
+			bindings_[id].var = var;
+		}
+
+		vector<Entry> bindings_;			// Innermost binding, indexed by Ident
+		vector<Binding> shadowed_;			// Bindings hidden by declarations in open scopes
+		vector<unsigned> scopes_;			// Size of shadowed_ when each scope was opened
+};
+
+#endif
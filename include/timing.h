@@ -0,0 +1,69 @@
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+#include <string>
+#include <vector>
+#include <iostream>
+using namespace std;
+
+/* Wall and CPU time of one phase of the compiler, or of one LLVM pass, in seconds */
+struct PhaseTime {
+	string name;
+	double wall, user, system;
+};
+
+/* The wall clock, and the CPU time the calling thread has used so far */
+PhaseTime ThreadTimes();
+
+/*
+ * Times of the phases of compiling one file (--time-report), in the
+ * order they ran. CPU times are those of the thread compiling the file,
+ * so the other files of a batch do not count; work the phase hands to
+ * other threads is added with addCPU.
+ */
+class TimeReport {
+	public:
+		TimeReport() : running_(false) {}
+
+		void setFile(const string &file) {
+			file_ = file;
+		}
+		const string &getFile() const {
+			return file_;
+		}
+		/* Starts timing phase, ending the phase in progress if any */
+		void start(const char *phase);
+		/* Ends the phase in progress */
+		void stop();
+		/* Adds CPU time spent on other threads to the phase last timed */
+		void addCPU(const PhaseTime &t);
+		/* The phase last timed, or nullptr */
+		PhaseTime *last() {
+			return phases_.empty() ? nullptr : &phases_.back();
+		}
+		const vector<PhaseTime> &getPhases() const {
+			return phases_;
+		}
+		PhaseTime getTotal() const;
+
+	private:
+		string file_;
+		vector<PhaseTime> phases_;
+		bool running_;
+		PhaseTime startTime_;		// Clocks when the phase in progress started
+};
+
+/*
+ * Has the LLVM pass managers time every pass they run, from now on. The
+ * timings of all the modules compiled meanwhile are added together.
+ */
+void EnablePassTiming();
+
+/* Takes the pass timings gathered since the last call, slowest first */
+void TakePassTimings(vector<PhaseTime> &passes);
+
+/* Prints the reports, and the pass timings if any, as tables or as JSON */
+void PrintTimeReport(ostream &os, const vector<TimeReport> &reports, const vector<PhaseTime> &passes);
+void PrintTimeReportJSON(ostream &os, const vector<TimeReport> &reports, const vector<PhaseTime> &passes);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef __WHOLEPROGRAM_H__
+#define __WHOLEPROGRAM_H__
+
+#include "stdllvm.h"
+using namespace llvm;
+
+/*
+ * Whole program mode (--whole-program). A Decaf program is one closed
+ * class, so nothing outside the module calls its methods but main, or uses
+ * its fields. Every other method becomes internal and fastcc (unless its
+ * address is taken, as for the bodies of parallel loops), methods and
+ * fields that main cannot reach are deleted, and the methods are marked
+ * nounwind, and readnone or readonly from what they and their callees do
+ * to memory. The module is left alone if it has no main.
+ */
+void InternalizeProgram(Module *M);
+
+#endif
@@ -0,0 +1,83 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include "include/jit.h"
+#include "include/emit.h"
+#include "include/runtime.h"
+#include "include/stdllvm.h"
+using namespace std;
+using namespace llvm;
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+bool RunModuleJIT(Module *M, int level, int *exitCode, JITTimes *times) {
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	InitializeNativeTarget();
+	InitializeNativeTargetAsmPrinter();
+
+	// Make the symbols of the running process (libc) visible to the JIT
+	sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+	// and the runtime library, which is linked into the compiler itself
+	sys::DynamicLibrary::AddSymbol("__decaf_parallel_for", (void *)&__decaf_parallel_for);
+	sys::DynamicLibrary::AddSymbol("__decaf_write_str", (void *)&__decaf_write_str);
+	sys::DynamicLibrary::AddSymbol("__decaf_write_int", (void *)&__decaf_write_int);
+	sys::DynamicLibrary::AddSymbol("__decaf_write_char", (void *)&__decaf_write_char);
+	sys::DynamicLibrary::AddSymbol("__decaf_flush", (void *)&__decaf_flush);
+	sys::DynamicLibrary::AddSymbol("__decaf_array_sum", (void *)&__decaf_array_sum);
+	sys::DynamicLibrary::AddSymbol("__decaf_array_min", (void *)&__decaf_array_min);
+	sys::DynamicLibrary::AddSymbol("__decaf_array_max", (void *)&__decaf_array_max);
+	sys::DynamicLibrary::AddSymbol("__decaf_array_fill", (void *)&__decaf_array_fill);
+	sys::DynamicLibrary::AddSymbol("__decaf_array_count", (void *)&__decaf_array_count);
+	sys::DynamicLibrary::AddSymbol("__decaf_array_dot", (void *)&__decaf_array_dot);
+	sys::DynamicLibrary::AddSymbol("__decaf_array_count_bool", (void *)&__decaf_array_count_bool);
+	sys::DynamicLibrary::AddSymbol("__decaf_array_dot_bool", (void *)&__decaf_array_dot_bool);
+
+	Function *mainF = M->getFunction("main");
+	if(!mainF || mainF->isDeclaration()) {
+		cerr << "No main method to run" << endl;
+		return false;
+	}
+	Type *retTy = mainF->getReturnType();
+
+	string err;
+	ExecutionEngine *EE = EngineBuilder(unique_ptr<Module>(M))
+							.setErrorStr(&err)
+							.setEngineKind(EngineKind::JIT)
+							.setMCJITMemoryManager(unique_ptr<RTDyldMemoryManager>(new SectionMemoryManager()))
+							.setOptLevel(GetCodeGenOptLevel(level))
+							.create();
+	if(!EE) {
+		cerr << "Cannot create the JIT: " << err << endl;
+		return false;
+	}
+	EE->finalizeObject();
+	EE->runStaticConstructorsDestructors(false);
+	uint64_t addr = EE->getFunctionAddress("main");
+	if(times) {
+		times->codegenSeconds = secondsSince(start);
+	}
+
+	start = chrono::steady_clock::now();
+	int ret = 0;
+	if(retTy->isIntegerTy(32)) {
+		ret = ((int (*)())addr)();
+	}
+	else if(retTy->isIntegerTy(1)) {
+		((bool (*)())addr)();
+	}
+	else {
+		((void (*)())addr)();
+	}
+	__decaf_flush();
+	fflush(stdout);
+	if(times) {
+		times->runSeconds = secondsSince(start);
+	}
+
+	EE->runStaticConstructorsDestructors(true);
+	delete EE;
+	*exitCode = ret;
+	return true;
+}
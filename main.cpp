@@ -1,30 +1,301 @@
 #include "include/head.h"
 #include "include/stdllvm.h"
+#include "include/driver.h"
+#include "include/server.h"
 #include <fstream>
+#include <thread>
+#include <atomic>
+#include <vector>
 using namespace llvm;
 
-extern Module *DecafToLLVM;
-extern IRBuilder<> *Builder;
+static void usage(const char *prog)
+{
+    cerr << "Usage: " << prog << " [-O0|-O1|-O2|-O3] [-passes=p1,p2,...] [-c|-S|--link|--run] [-j jobs] [-o output] file... | @files\n";
+    cerr << "  -c        write a native object file (file.o)\n";
+    cerr << "  -S        write native assembly (file.s)\n";
+    cerr << "  --link    write a native executable (file.out), linked with the system cc\n";
+    cerr << "  --run     compile in memory and run main(), exiting with its return value\n";
+    cerr << "  --whole-program\n";
+    cerr << "            make every method but main internal and fastcc, drop the unused methods\n";
+    cerr << "            and fields, and infer readnone, readonly and nounwind for the methods\n";
+    cerr << "  -j jobs   number of threads (default: all cores). Several files are compiled\n";
+    cerr << "            concurrently; the methods of a single file are generated in parallel\n";
+    cerr << "  @files    read the input files from files, one per line\n";
+    cerr << "  --cache   reuse outputs from the cache (also enabled by setting DECAF_CACHE_DIR)\n";
+    cerr << "  --incremental\n";
+    cerr << "            with the cache, also reuse the IR of the methods that did not change\n";
+    cerr << "  --cache-dir=dir, --cache-size=size[K|M|G]\n";
+    cerr << "            directory (default: " << CompileCache::defaultDirectory() << ") and size limit (default: 1G) of the cache\n";
+    cerr << "  --cache-stats\n";
+    cerr << "            print the hits, misses and size of the cache after compiling\n";
+    cerr << "  --time-report[=text|json]\n";
+    cerr << "            print the wall and CPU time of every phase and LLVM pass on stderr\n";
+    cerr << "  --time-report-file=file\n";
+    cerr << "            write the time report to file instead\n";
+    cerr << "  --mem-report\n";
+    cerr << "            print the objects and bytes of every AST class, the strings, the size of\n";
+    cerr << "            the LLVM module and the peak RSS on stderr\n";
+    cerr << "  --server  compile the requests of --client, listening on the socket\n";
+    cerr << "  --client  have the server compile the file (- for standard input)\n";
+    cerr << "  --socket path\n";
+    cerr << "            socket of the compile server (default: " << DefaultSocketPath() << ")\n";
+    cerr << "  default   write LLVM bitcode (file.bc)\n";
+    exit( 1 );
+}
+
+// Parses a size such as 512M. Returns 0 if it is not one
+static uint64_t parseSize(const string &s)
+{
+    char *end;
+    uint64_t n = strtoull(s.c_str(), &end, 10);
+    switch (*end)
+    {
+        case 'G': case 'g': n <<= 10;
+        case 'M': case 'm': n <<= 10;
+        case 'K': case 'k': n <<= 10; end++;
+        default: break;
+    }
+    return *end ? 0 : n;
+}
+
+// Appends the non-empty lines of a response file to inputs
+static bool readResponseFile(const char *path, vector<string> &inputs)
+{
+    ifstream in(path);
+    if (!in)
+        return false;
+    string line;
+    while (getline(in, line))
+    {
+        size_t end = line.find_last_not_of(" \t\r");
+        if (end != string::npos)
+            inputs.push_back(line.substr(0, end + 1));
+    }
+    return true;
+}
 
-// prototype of bison-generated parser function
-int yyparse();
+// Prints the time report, with the timings of the LLVM passes, on stderr or to file
+static bool printTimeReport(const vector<TimeReport> &reports, bool json, const string &file)
+{
+    vector<PhaseTime> passes;
+    TakePassTimings(passes);
+    ofstream out;
+    if (!file.empty())
+    {
+        out.open(file.c_str());
+        if (!out)
+        {
+            cerr << ProgName << ": Cannot write the time report to " << file << ".\n";
+            return false;
+        }
+    }
+    ostream &os = file.empty() ? cerr : out;
+    if (json)
+        PrintTimeReportJSON(os, reports, passes);
+    else
+        PrintTimeReport(os, reports, passes);
+    return true;
+}
 
 int main(int argc, char **argv)
 {
-    if ((argc > 1) && (freopen(argv[1], "r", stdin) == NULL))
+    CompileOptions opts;
+    opts.optLevel = 0;
+    opts.emit = EMIT_BITCODE;
+    string output;
+    vector<string> inputs;
+    unsigned jobs = thread::hardware_concurrency();
+    opts.target = NULL;
+    opts.cache = NULL;
+    opts.incremental = false;
+    opts.wholeProgram = false;
+    ProgName = argv[0];
+    bool useCache = getenv("DECAF_CACHE_DIR") != NULL, cacheStats = false;
+    string cacheDir = CompileCache::defaultDirectory();
+    uint64_t cacheSize = parseSize(getenv("DECAF_CACHE_SIZE") ? getenv("DECAF_CACHE_SIZE") : "1G");
+    bool server = false, client = false;
+    enum { NO_REPORT, TEXT_REPORT, JSON_REPORT } timeReport = NO_REPORT;
+    string timeReportFile;
+    bool memReport = false;
+    string socketPath = DefaultSocketPath();
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg(argv[i]);
+        if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0' && arg[2] <= '3')
+            opts.optLevel = arg[2] - '0';
+        else if (arg.compare(0, 8, "-passes=") == 0)
+            opts.pipeline = arg.substr(8);
+        else if (arg == "-c")
+            opts.emit = EMIT_OBJECT;
+        else if (arg == "-S")
+            opts.emit = EMIT_ASSEMBLY;
+        else if (arg == "--link")
+            opts.emit = EMIT_EXECUTABLE;
+        else if (arg == "--run")
+            opts.emit = RUN_JIT;
+        else if (arg == "-j" && i + 1 < argc)
+            jobs = atoi(argv[++i]);
+        else if (arg.compare(0, 2, "-j") == 0 && arg.size() > 2)
+            jobs = atoi(arg.c_str() + 2);
+        else if (arg == "-o" && i + 1 < argc)
+            output = argv[++i];
+        else if (arg == "--whole-program")
+            opts.wholeProgram = true;
+        else if (arg == "--cache")
+            useCache = true;
+        else if (arg == "--incremental")
+            useCache = opts.incremental = true;
+        else if (arg.compare(0, 12, "--cache-dir=") == 0)
+        {
+            useCache = true;
+            cacheDir = arg.substr(12);
+        }
+        else if (arg.compare(0, 13, "--cache-size=") == 0 && parseSize(arg.substr(13)))
+            cacheSize = parseSize(arg.substr(13));
+        else if (arg == "--cache-stats")
+            cacheStats = true;
+        else if (arg == "--time-report" || arg == "--time-report=text")
+            timeReport = TEXT_REPORT;
+        else if (arg == "--time-report=json")
+            timeReport = JSON_REPORT;
+        else if (arg.compare(0, 19, "--time-report-file=") == 0)
+        {
+            timeReportFile = arg.substr(19);
+            if (timeReport == NO_REPORT)
+                timeReport = TEXT_REPORT;
+        }
+        else if (arg == "--mem-report")
+            memReport = true;
+        else if (arg == "--server")
+            server = true;
+        else if (arg == "--client")
+            client = true;
+        else if (arg == "--socket" && i + 1 < argc)
+            socketPath = argv[++i];
+        else if (arg == "-" && client)
+            inputs.push_back(arg);
+        else if (arg[0] == '@')
+        {
+            if (!readResponseFile(argv[i] + 1, inputs))
+            {
+                cerr << argv[0] << ": Response file " << argv[i] + 1 << " cannot be opened.\n";
+                exit( 1 );
+            }
+        }
+        else if (arg[0] == '-')
+            usage(argv[0]);
+        else
+            inputs.push_back(arg);
+    }
+    if (jobs == 0)
+        jobs = 1;
+    if (server)
+    {
+        if (!inputs.empty() || client)
+            usage(argv[0]);
+        return RunServer(socketPath, jobs);
+    }
+    if (cacheSize == 0)
+        cacheSize = parseSize("1G");
+    CompileCache *cache = NULL;
+    if (useCache || cacheStats)
+        cache = new CompileCache(cacheDir, cacheSize);
+    if (useCache)
+        opts.cache = cache;
+    if (inputs.empty() && cacheStats)
+    {
+        cache->printStats(cout);
+        return 0;
+    }
+    if (inputs.empty())
+        usage(argv[0]);
+    if (inputs.size() > 1 && (!output.empty() || opts.emit == RUN_JIT))
     {
-        cerr << argv[0] << ": File " << argv[1] << " cannot be opened.\n";
+        cerr << argv[0] << ": -o and --run take a single input file.\n";
         exit( 1 );
     }
-    string fname(argv[1]);
-    fname += ".bc";
-    error_code EC;
-    raw_fd_ostream bc_file(StringRef(fname.c_str()), EC, llvm::sys::fs::F_None);
-    Builder = new IRBuilder<>(getGlobalContext());
-    DecafToLLVM = new Module("DecafToLLVM", getGlobalContext());
+    if (client)
+    {
+        if (inputs.size() != 1 || opts.emit == RUN_JIT)
+        {
+            cerr << argv[0] << ": --client takes a single input file and cannot --run.\n";
+            exit( 1 );
+        }
+        if (output.empty())
+            output = (inputs[0] == "-" ? string("a") : inputs[0]) + DefaultExtension(opts.emit);
+        return RunClient(socketPath, inputs[0], output, opts);
+    }
+
+    // Register the target once, before any thread asks for it
+    if (opts.emit != EMIT_BITCODE)
+    {
+        InitializeNativeTarget();
+        InitializeNativeTargetAsmPrinter();
+    }
 
-    yyparse();
-    WriteBitcodeToFile(DecafToLLVM, bc_file);
+    // One report per input, filled by the thread compiling it
+    vector<TimeReport> reports(timeReport != NO_REPORT ? inputs.size() : 0);
+    for (unsigned i = 0; i < reports.size(); i++)
+        reports[i].setFile(inputs[i]);
+    if (timeReport != NO_REPORT)
+        EnablePassTiming();
+    vector<MemReport> memReports(memReport ? inputs.size() : 0);
+    for (unsigned i = 0; i < memReports.size(); i++)
+        memReports[i].file = inputs[i];
 
+    if (inputs.size() == 1)
+    {
+        opts.jobs = jobs;
+        int ret = 0;
+        bool ok = CompileFile(inputs[0], output.empty() ? inputs[0] + DefaultExtension(opts.emit) : output, opts, &ret,
+                              reports.empty() ? NULL : &reports[0], memReports.empty() ? NULL : &memReports[0]);
+        if (cacheStats)
+            cache->printStats(cerr);
+        if (timeReport != NO_REPORT && !printTimeReport(reports, timeReport == JSON_REPORT, timeReportFile))
+            exit( 1 );
+        if (memReport)
+            PrintMemReport(cerr, memReports);
+        if (!ok)
+            exit( 1 );
+        return ret;
+    }
+
+    /*
+     * Batch mode : the threads take the files in turn. When there are fewer
+     * files than threads, the spare threads go to generating their methods.
+     */
+    unsigned workers = min<size_t>(jobs, inputs.size());
+    opts.jobs = max(1u, jobs / workers);
+    atomic<unsigned> next(0);
+    atomic<unsigned> failed(0);
+    vector<thread> pool;
+    for (unsigned t = 0; t < workers; t++)
+    {
+        pool.push_back(thread([&]() {
+            unsigned i;
+            while ((i = next++) < inputs.size())
+            {
+                int ret;
+                if (!CompileFile(inputs[i], inputs[i] + DefaultExtension(opts.emit), opts, &ret,
+                                 reports.empty() ? NULL : &reports[i], memReports.empty() ? NULL : &memReports[i]))
+                    failed++;
+            }
+        }));
+    }
+    for (unsigned t = 0; t < pool.size(); t++)
+        pool[t].join();
+    if (cacheStats)
+        cache->printStats(cerr);
+    if (timeReport != NO_REPORT && !printTimeReport(reports, timeReport == JSON_REPORT, timeReportFile))
+        return 1;
+    if (memReport)
+        PrintMemReport(cerr, memReports);
+
+    if (failed)
+    {
+        cerr << argv[0] << ": " << failed.load() << " of " << inputs.size() << " files failed to compile.\n";
+        return 1;
+    }
     return 0;
 }
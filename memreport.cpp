@@ -0,0 +1,102 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <sys/resource.h>
+#include "include/memreport.h"
+#include "include/ast.h"
+#include "include/stdllvm.h"
+using namespace std;
+using namespace llvm;
+
+static bool moreBytes(const ArenaUsage &a, const ArenaUsage &b) {
+	return a.bytes > b.bytes;
+}
+
+void RecordSessionMemory(const CompilationSession *session, MemReport *report) {
+	report->recorded = true;
+	report->classes.clear();
+	for(unsigned id = 0; id < NUM_ARENA_TYPES; id++) {
+		if(session->getUsage(id).count) {
+			report->classes.push_back(session->getUsage(id));
+		}
+	}
+	std::stable_sort(report->classes.begin(), report->classes.end(), moreBytes);
+	report->arenaBytes = session->getBytesAllocated();
+	report->listBytes = session->getListBytes();
+	report->stringBytes = session->getStringBytes();
+	report->identifierBytes = session->getIdentifierBytes();
+	report->identifiers = session->getNumIdentifiers();
+}
+
+void RecordModuleSize(const Module *M, ModuleSize *size) {
+	size->functions = size->globals = size->blocks = size->instructions = 0;
+	for(Module::const_iterator F = M->begin(); F != M->end(); F++) {
+		if(F->isDeclaration()) {
+			continue;
+		}
+		size->functions++;
+		for(Function::const_iterator BB = F->begin(); BB != F->end(); BB++) {
+			size->blocks++;
+			size->instructions += BB->size();
+		}
+	}
+	for(Module::const_global_iterator G = M->global_begin(); G != M->global_end(); G++) {
+		size->globals++;
+	}
+}
+
+static void printLine(ostream &os, const char *name, size_t count, size_t bytes) {
+	char line[160];
+	if(count) {
+		snprintf(line, sizeof(line), "  %-34s %10zu %12zu\n", name, count, bytes);
+	}
+	else {
+		snprintf(line, sizeof(line), "  %-34s %10s %12zu\n", name, "", bytes);
+	}
+	os << line;
+}
+
+static void printModule(ostream &os, const char *when, const ModuleSize &size) {
+	char line[160];
+	snprintf(line, sizeof(line), "  LLVM module %-22s %u functions, %u globals, %u basic blocks, %u instructions\n",
+			 when, size.functions, size.globals, size.blocks, size.instructions);
+	os << line;
+}
+
+void PrintMemReport(ostream &os, const vector<MemReport> &reports) {
+	for(unsigned i = 0; i < reports.size(); i++) {
+		const MemReport &r = reports[i];
+		if(!r.recorded) {
+			continue;
+		}
+		os << "===-- Memory report for " << r.file << " --===\n";
+		os << "  Class                                   Count        Bytes\n";
+		size_t count = 0, bytes = 0;
+		for(unsigned c = 0; c < r.classes.size(); c++) {
+			printLine(os, r.classes[c].name, r.classes[c].count, r.classes[c].bytes);
+			count += r.classes[c].count;
+			bytes += r.classes[c].bytes;
+		}
+		printLine(os, "All objects", count, bytes);
+		printLine(os, "Child arrays", 0, r.listBytes);
+		printLine(os, "String literals (lexer)", 0, r.stringBytes);
+		printLine(os, ("Identifiers (" + to_string(r.identifiers) + " names)").c_str(), 0, r.identifierBytes);
+		printLine(os, "Arena, with unused slack", 0, r.arenaBytes);
+		if(r.hasModule) {
+			printModule(os, "(generated)", r.module);
+		}
+		if(r.hasOptimized) {
+			printModule(os, "(optimized)", r.optimized);
+		}
+		os << "\n";
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	char line[80];
+	// ru_maxrss is in kilobytes on Linux
+	snprintf(line, sizeof(line), "Peak resident set size : %.1f MB\n", usage.ru_maxrss / 1024.0);
+	os << line;
+}
@@ -0,0 +1,137 @@
+#include <iostream>
+#include <string>
+#include <sstream>
+#include "include/optimize.h"
+#include "include/stdllvm.h"
+using namespace std;
+using namespace llvm;
+
+bool VerifyIR(Module *M) {
+	return !verifyModule(*M, &errs());
+}
+
+/*
+ * Passes that can be named in an explicit pipeline (-passes=a,b,c).
+ * The names are the same ones `opt` uses for these passes.
+ */
+static Pass *createPassByName(const string &name) {
+	if(name == "mem2reg")
+		return createPromoteMemoryToRegisterPass();
+	if(name == "sroa")
+		return createSROAPass();
+	if(name == "early-cse")
+		return createEarlyCSEPass();
+	if(name == "instcombine")
+		return createInstructionCombiningPass();
+	if(name == "simplifycfg")
+		return createCFGSimplificationPass();
+	if(name == "reassociate")
+		return createReassociatePass();
+	if(name == "sccp")
+		return createSCCPPass();
+	if(name == "gvn")
+		return createGVNPass();
+	if(name == "dse")
+		return createDeadStoreEliminationPass();
+	if(name == "adce")
+		return createAggressiveDCEPass();
+	if(name == "loop-rotate")
+		return createLoopRotatePass();
+	if(name == "licm")
+		return createLICMPass();
+	if(name == "indvars")
+		return createIndVarSimplifyPass();
+	if(name == "loop-unroll")
+		return createLoopUnrollPass();
+	if(name == "loop-vectorize")
+		return createLoopVectorizePass();
+	if(name == "slp-vectorizer")
+		return createSLPVectorizerPass();
+	if(name == "tailcallelim")
+		return createTailCallEliminationPass();
+	if(name == "inline")
+		return createFunctionInliningPass();
+	if(name == "globaldce")
+		return createGlobalDCEPass();
+	if(name == "globalopt")
+		return createGlobalOptimizerPass();
+	return nullptr;
+}
+
+/*
+ * Target information for the passes, when the module has been prepared
+ * for a target (see PrepareModuleForTarget).
+ */
+static void addTargetPasses(Module *M, TargetMachine *TM, legacy::PassManagerBase &PM) {
+	if(M->getDataLayout()) {
+		PM.add(new DataLayoutPass());
+	}
+	if(TM) {
+		TM->addAnalysisPasses(PM);
+	}
+}
+
+/*
+ * An explicit pipeline is run as given, in a single module pass manager.
+ */
+static bool runPipeline(Module *M, const string &pipeline, TargetMachine *TM) {
+	legacy::PassManager PM;
+	addTargetPasses(M, TM, PM);
+	stringstream ss(pipeline);
+	string name;
+	while(getline(ss, name, ',')) {
+		if(name.empty()) {
+			continue;
+		}
+		Pass *P = createPassByName(name);
+		if(!P) {
+			cerr << "Unknown pass \"" << name << "\" in -passes=" << pipeline << endl;
+			return false;
+		}
+		PM.add(P);
+	}
+	PM.run(*M);
+	return true;
+}
+
+/*
+ * Level based pipeline. Our IR keeps every variable in an alloca, so
+ * mem2reg is always run first; the rest of the pipeline is the standard
+ * one LLVM builds for the level. Inlining is enabled from -O1, loop
+ * unrolling and the vectorizers from -O2.
+ */
+bool OptimizeModule(Module *M, int level, const string &pipeline, TargetMachine *TM) {
+	if(!pipeline.empty()) {
+		return runPipeline(M, pipeline, TM);
+	}
+	if(level <= 0) {
+		return true;
+	}
+
+	PassManagerBuilder PMB;
+	PMB.OptLevel = level;
+	PMB.SizeLevel = 0;
+	PMB.Inliner = createFunctionInliningPass(level, 0);
+	PMB.DisableUnrollLoops = (level < 2);
+	PMB.LoopVectorize = (level >= 2);
+	PMB.SLPVectorize = (level >= 2);
+
+	legacy::FunctionPassManager FPM(M);
+	addTargetPasses(M, TM, FPM);
+	FPM.add(createPromoteMemoryToRegisterPass());
+	PMB.populateFunctionPassManager(FPM);
+
+	legacy::PassManager MPM;
+	addTargetPasses(M, TM, MPM);
+	PMB.populateModulePassManager(MPM);
+
+	FPM.doInitialization();
+	for(Module::iterator F = M->begin(); F != M->end(); F++) {
+		if(!F->isDeclaration()) {
+			FPM.run(*F);
+		}
+	}
+	FPM.doFinalization();
+	MPM.run(*M);
+	return true;
+}
@@ -0,0 +1,375 @@
+/*
+ * Kernels of the array builtins (array_sum, array_min...). Each comes in
+ * a scalar version and, on x86, in SSE4.1 and AVX2 versions, the set used
+ * being picked once at start up from what the processor supports, or
+ * capped by $DECAF_SIMD ("scalar" or "sse4.1"). Integer arithmetic wraps
+ * around as in the compiled code, and booleans are bytes holding 0 or 1.
+ */
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/runtime.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define X86_KERNELS
+#include <immintrin.h>
+#define SSE41 __attribute__((target("sse4.1")))
+#define AVX2 __attribute__((target("avx2")))
+#endif
+
+struct kernels {
+	int (*sum)(const int *a, int n);
+	int (*min)(const int *a, int n);
+	int (*max)(const int *a, int n);
+	void (*fill)(int *a, int n, int v);
+	int (*count)(const int *a, int n, int v);
+	int (*dot)(const int *a, const int *b, int n);
+	int (*countBool)(const unsigned char *a, int n, int v);
+	int (*dotBool)(const unsigned char *a, const unsigned char *b, int n);
+};
+
+static int sumScalar(const int *a, int n)
+{
+	unsigned int s = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		s += (unsigned int)a[i];
+	}
+	return (int)s;
+}
+
+static int minScalar(const int *a, int n)
+{
+	int m = INT_MAX, i;
+	for (i = 0; i < n; i++) {
+		m = a[i] < m ? a[i] : m;
+	}
+	return m;
+}
+
+static int maxScalar(const int *a, int n)
+{
+	int m = INT_MIN, i;
+	for (i = 0; i < n; i++) {
+		m = a[i] > m ? a[i] : m;
+	}
+	return m;
+}
+
+static void fillScalar(int *a, int n, int v)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		a[i] = v;
+	}
+}
+
+static int countScalar(const int *a, int n, int v)
+{
+	int c = 0, i;
+	for (i = 0; i < n; i++) {
+		c += a[i] == v;
+	}
+	return c;
+}
+
+static int dotScalar(const int *a, const int *b, int n)
+{
+	unsigned int s = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		s += (unsigned int)a[i] * (unsigned int)b[i];
+	}
+	return (int)s;
+}
+
+static int countBoolScalar(const unsigned char *a, int n, int v)
+{
+	int c = 0, i;
+	for (i = 0; i < n; i++) {
+		c += a[i] == v;
+	}
+	return c;
+}
+
+static int dotBoolScalar(const unsigned char *a, const unsigned char *b, int n)
+{
+	int c = 0, i;
+	for (i = 0; i < n; i++) {
+		c += a[i] & b[i];
+	}
+	return c;
+}
+
+static const struct kernels scalarKernels = {
+	sumScalar, minScalar, maxScalar, fillScalar, countScalar, dotScalar, countBoolScalar, dotBoolScalar
+};
+
+#ifdef X86_KERNELS
+
+/* Horizontal reductions of the four lanes of a vector */
+static inline SSE41 int hsum128(__m128i v)
+{
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(v);
+}
+
+static inline SSE41 int hmin128(__m128i v)
+{
+	v = _mm_min_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_min_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(v);
+}
+
+static inline SSE41 int hmax128(__m128i v)
+{
+	v = _mm_max_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_max_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(v);
+}
+
+#define LOAD128(p) _mm_loadu_si128((const __m128i *)(p))
+#define LOAD256(p) _mm256_loadu_si256((const __m256i *)(p))
+
+/* Bytes holding 0 or 1 : the low bit of each byte moved to its sign bit, as movemask wants */
+#define BYTES128(v) _mm_movemask_epi8(_mm_slli_epi16((v), 7))
+#define BYTES256(v) (unsigned int)_mm256_movemask_epi8(_mm256_slli_epi16((v), 7))
+
+static SSE41 int sumSSE41(const int *a, int n)
+{
+	__m128i s = _mm_setzero_si128();
+	int i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		s = _mm_add_epi32(s, LOAD128(a + i));
+	}
+	return (int)((unsigned int)hsum128(s) + (unsigned int)sumScalar(a + i, n - i));
+}
+
+static SSE41 int minSSE41(const int *a, int n)
+{
+	__m128i m = _mm_set1_epi32(INT_MAX);
+	int i, rest;
+	for (i = 0; i + 4 <= n; i += 4) {
+		m = _mm_min_epi32(m, LOAD128(a + i));
+	}
+	rest = minScalar(a + i, n - i);
+	i = hmin128(m);
+	return i < rest ? i : rest;
+}
+
+static SSE41 int maxSSE41(const int *a, int n)
+{
+	__m128i m = _mm_set1_epi32(INT_MIN);
+	int i, rest;
+	for (i = 0; i + 4 <= n; i += 4) {
+		m = _mm_max_epi32(m, LOAD128(a + i));
+	}
+	rest = maxScalar(a + i, n - i);
+	i = hmax128(m);
+	return i > rest ? i : rest;
+}
+
+static SSE41 void fillSSE41(int *a, int n, int v)
+{
+	__m128i x = _mm_set1_epi32(v);
+	int i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		_mm_storeu_si128((__m128i *)(a + i), x);
+	}
+	fillScalar(a + i, n - i, v);
+}
+
+static SSE41 int countSSE41(const int *a, int n, int v)
+{
+	__m128i x = _mm_set1_epi32(v), c = _mm_setzero_si128();
+	int i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		c = _mm_sub_epi32(c, _mm_cmpeq_epi32(LOAD128(a + i), x));
+	}
+	return hsum128(c) + countScalar(a + i, n - i, v);
+}
+
+static SSE41 int dotSSE41(const int *a, const int *b, int n)
+{
+	__m128i s = _mm_setzero_si128();
+	int i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		s = _mm_add_epi32(s, _mm_mullo_epi32(LOAD128(a + i), LOAD128(b + i)));
+	}
+	return (int)((unsigned int)hsum128(s) + (unsigned int)dotScalar(a + i, b + i, n - i));
+}
+
+static SSE41 int countBoolSSE41(const unsigned char *a, int n, int v)
+{
+	__m128i x = _mm_set1_epi8((char)v);
+	int c = 0, i;
+	for (i = 0; i + 16 <= n; i += 16) {
+		c += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(LOAD128(a + i), x)));
+	}
+	return c + countBoolScalar(a + i, n - i, v);
+}
+
+static SSE41 int dotBoolSSE41(const unsigned char *a, const unsigned char *b, int n)
+{
+	int c = 0, i;
+	for (i = 0; i + 16 <= n; i += 16) {
+		c += __builtin_popcount(BYTES128(_mm_and_si128(LOAD128(a + i), LOAD128(b + i))));
+	}
+	return c + dotBoolScalar(a + i, b + i, n - i);
+}
+
+static const struct kernels sse41Kernels = {
+	sumSSE41, minSSE41, maxSSE41, fillSSE41, countSSE41, dotSSE41, countBoolSSE41, dotBoolSSE41
+};
+
+static AVX2 int sumAVX2(const int *a, int n)
+{
+	__m256i s0 = _mm256_setzero_si256(), s1 = _mm256_setzero_si256();
+	int i;
+	for (i = 0; i + 16 <= n; i += 16) {
+		s0 = _mm256_add_epi32(s0, LOAD256(a + i));
+		s1 = _mm256_add_epi32(s1, LOAD256(a + i + 8));
+	}
+	s0 = _mm256_add_epi32(s0, s1);
+	return (int)((unsigned int)hsum128(_mm_add_epi32(_mm256_castsi256_si128(s0), _mm256_extracti128_si256(s0, 1))) +
+				 (unsigned int)sumSSE41(a + i, n - i));
+}
+
+static AVX2 int minAVX2(const int *a, int n)
+{
+	__m256i m = _mm256_set1_epi32(INT_MAX);
+	int i, rest;
+	for (i = 0; i + 8 <= n; i += 8) {
+		m = _mm256_min_epi32(m, LOAD256(a + i));
+	}
+	rest = minScalar(a + i, n - i);
+	i = hmin128(_mm_min_epi32(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1)));
+	return i < rest ? i : rest;
+}
+
+static AVX2 int maxAVX2(const int *a, int n)
+{
+	__m256i m = _mm256_set1_epi32(INT_MIN);
+	int i, rest;
+	for (i = 0; i + 8 <= n; i += 8) {
+		m = _mm256_max_epi32(m, LOAD256(a + i));
+	}
+	rest = maxScalar(a + i, n - i);
+	i = hmax128(_mm_max_epi32(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1)));
+	return i > rest ? i : rest;
+}
+
+static AVX2 void fillAVX2(int *a, int n, int v)
+{
+	__m256i x = _mm256_set1_epi32(v);
+	int i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		_mm256_storeu_si256((__m256i *)(a + i), x);
+	}
+	fillScalar(a + i, n - i, v);
+}
+
+static AVX2 int countAVX2(const int *a, int n, int v)
+{
+	__m256i x = _mm256_set1_epi32(v), c = _mm256_setzero_si256();
+	int i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		c = _mm256_sub_epi32(c, _mm256_cmpeq_epi32(LOAD256(a + i), x));
+	}
+	return hsum128(_mm_add_epi32(_mm256_castsi256_si128(c), _mm256_extracti128_si256(c, 1))) +
+		   countScalar(a + i, n - i, v);
+}
+
+static AVX2 int dotAVX2(const int *a, const int *b, int n)
+{
+	__m256i s = _mm256_setzero_si256();
+	int i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		s = _mm256_add_epi32(s, _mm256_mullo_epi32(LOAD256(a + i), LOAD256(b + i)));
+	}
+	return (int)((unsigned int)hsum128(_mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1))) +
+				 (unsigned int)dotScalar(a + i, b + i, n - i));
+}
+
+static AVX2 int countBoolAVX2(const unsigned char *a, int n, int v)
+{
+	__m256i x = _mm256_set1_epi8((char)v);
+	int c = 0, i;
+	for (i = 0; i + 32 <= n; i += 32) {
+		c += __builtin_popcount((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(LOAD256(a + i), x)));
+	}
+	return c + countBoolSSE41(a + i, n - i, v);
+}
+
+static AVX2 int dotBoolAVX2(const unsigned char *a, const unsigned char *b, int n)
+{
+	int c = 0, i;
+	for (i = 0; i + 32 <= n; i += 32) {
+		c += __builtin_popcount(BYTES256(_mm256_and_si256(LOAD256(a + i), LOAD256(b + i))));
+	}
+	return c + dotBoolSSE41(a + i, b + i, n - i);
+}
+
+static const struct kernels avx2Kernels = {
+	sumAVX2, minAVX2, maxAVX2, fillAVX2, countAVX2, dotAVX2, countBoolAVX2, dotBoolAVX2
+};
+
+#endif
+
+static const struct kernels *active = &scalarKernels;
+
+__attribute__((constructor)) static void selectKernels(void)
+{
+#ifdef X86_KERNELS
+	const char *cap = getenv("DECAF_SIMD");
+	int level = !cap ? 2 : strcmp(cap, "scalar") == 0 ? 0 : strcmp(cap, "sse4.1") == 0 ? 1 : 2;
+	__builtin_cpu_init();
+	if (level >= 2 && __builtin_cpu_supports("avx2")) {
+		active = &avx2Kernels;
+	}
+	else if (level >= 1 && __builtin_cpu_supports("sse4.1")) {
+		active = &sse41Kernels;
+	}
+#endif
+}
+
+int __decaf_array_sum(const int *a, int n)
+{
+	return active->sum(a, n);
+}
+
+int __decaf_array_min(const int *a, int n)
+{
+	return active->min(a, n);
+}
+
+int __decaf_array_max(const int *a, int n)
+{
+	return active->max(a, n);
+}
+
+void __decaf_array_fill(int *a, int n, int v)
+{
+	active->fill(a, n, v);
+}
+
+int __decaf_array_count(const int *a, int n, int v)
+{
+	return active->count(a, n, v);
+}
+
+int __decaf_array_dot(const int *a, const int *b, int n)
+{
+	return active->dot(a, b, n);
+}
+
+int __decaf_array_count_bool(const unsigned char *a, int n, int v)
+{
+	return active->countBool(a, n, v);
+}
+
+int __decaf_array_dot_bool(const unsigned char *a, const unsigned char *b, int n)
+{
+	return active->dotBool(a, b, n);
+}
@@ -0,0 +1,114 @@
+/*
+ * Buffered output of the callouts to printf that the compiler lowers.
+ * Every thread writes into a buffer of its own, without locking, and the
+ * buffer goes to stdout in one fwrite when it is full, before a callout
+ * that is not lowered, when a parallel loop starts or ends on the thread,
+ * and at exit. Going through the stdout stream, rather than straight to
+ * the file descriptor, keeps the buffered text in order with whatever the
+ * program prints with stdio.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/runtime.h"
+
+#define BUFFER_SIZE (1 << 20)
+
+static __thread char *buffer;
+static __thread int used;
+
+static pthread_once_t registered = PTHREAD_ONCE_INIT;
+
+static void flushAtExit(void)
+{
+	__decaf_flush();
+}
+
+static void registerFlush(void)
+{
+	atexit(flushAtExit);
+}
+
+/*
+ * Makes room for n bytes, returning 0 if the buffer cannot hold them. A
+ * full buffer is written up to its last newline, so that the lines of the
+ * threads of a parallel loop do not get cut into each other.
+ */
+static int reserve(int n)
+{
+	if (!buffer) {
+		pthread_once(&registered, registerFlush);
+		buffer = malloc(BUFFER_SIZE);
+		if (!buffer) {
+			return 0;
+		}
+	}
+	if (used + n > BUFFER_SIZE) {
+		int end = used;
+		while (end > 0 && buffer[end - 1] != '\n') {
+			end--;
+		}
+		if (end == 0 || used - end + n > BUFFER_SIZE) {
+			__decaf_flush();
+		}
+		else {
+			fwrite(buffer, 1, end, stdout);
+			memmove(buffer, buffer + end, used - end);
+			used -= end;
+		}
+	}
+	return n <= BUFFER_SIZE;
+}
+
+void __decaf_flush(void)
+{
+	if (used > 0) {
+		fwrite(buffer, 1, used, stdout);
+		used = 0;
+	}
+}
+
+int __decaf_write_str(const char *s, int len)
+{
+	if (!reserve(len)) {
+		__decaf_flush();
+		fwrite(s, 1, len, stdout);
+		return len;
+	}
+	memcpy(buffer + used, s, len);
+	used += len;
+	return len;
+}
+
+int __decaf_write_char(int c)
+{
+	if (!reserve(1)) {
+		putchar(c);
+		return 1;
+	}
+	buffer[used++] = (char)c;
+	return 1;
+}
+
+int __decaf_write_int(int v)
+{
+	char digits[16];
+	unsigned int u = v < 0 ? 0u - (unsigned int)v : (unsigned int)v;
+	int n = 0, len;
+	do {
+		digits[n++] = (char)('0' + u % 10);
+		u /= 10;
+	} while (u);
+	if (v < 0) {
+		digits[n++] = '-';
+	}
+	len = n;
+	if (!reserve(len)) {
+		return printf("%d", v);
+	}
+	while (n > 0) {
+		buffer[used++] = digits[--n];
+	}
+	return len;
+}
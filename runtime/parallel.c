@@ -0,0 +1,202 @@
+/*
+ * Thread pool of parallel for loops. Every thread taking part in a loop,
+ * the caller included, owns a range of the iterations, split evenly when
+ * the loop starts. It runs its range a chunk at a time from the front,
+ * and once the range is empty it steals the back half of the range of
+ * another thread, until there is nothing left to steal. Ranges are small
+ * records behind a lock of their own, so owners and thieves only ever
+ * contend for the one range they both want.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../include/runtime.h"
+
+typedef void (*body_fn)(void *ctx, int lo, int hi);
+
+/* Iterations [lo, hi] left to a thread, empty when lo > hi */
+struct range {
+	pthread_mutex_t lock;
+	long long lo, hi;
+	char pad[64];			/* Keeps the ranges of two threads off one cache line */
+};
+
+static struct {
+	int threads;			/* Threads taking part in a loop, the caller included */
+	struct range *ranges;
+	pthread_mutex_t submit;	/* Held by the thread whose loop runs on the pool */
+
+	/* The running loop */
+	body_fn body;
+	void *ctx;
+	long long grain;
+
+	pthread_mutex_t lock;	/* Guards the fields below */
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	unsigned long generation;	/* Number of loops started */
+	int busy;				/* Workers still running the current loop */
+} pool = { 0, NULL, PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0,
+		   PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0 };
+
+static pthread_once_t started = PTHREAD_ONCE_INIT;
+
+/* Set while the thread runs iterations, so that inner loops run in place */
+static __thread int inLoop;
+
+/* Takes the next chunk of the thread's own range */
+static int takeChunk(int self, long long *lo, long long *hi)
+{
+	struct range *r = &pool.ranges[self];
+	int found = 0;
+	pthread_mutex_lock(&r->lock);
+	if (r->lo <= r->hi) {
+		*lo = r->lo;
+		*hi = r->hi - r->lo < pool.grain ? r->hi : r->lo + pool.grain - 1;
+		r->lo = *hi + 1;
+		found = 1;
+	}
+	pthread_mutex_unlock(&r->lock);
+	return found;
+}
+
+/* Moves the back half of another thread's range into the thread's own */
+static int steal(int self)
+{
+	int i;
+	for (i = 1; i < pool.threads; i++) {
+		struct range *victim = &pool.ranges[(self + i) % pool.threads];
+		long long lo, hi;
+		pthread_mutex_lock(&victim->lock);
+		hi = victim->hi;
+		lo = victim->lo + (victim->hi - victim->lo + 1) / 2;
+		if (lo <= hi) {
+			victim->hi = lo - 1;
+		}
+		pthread_mutex_unlock(&victim->lock);
+		if (lo <= hi) {
+			struct range *r = &pool.ranges[self];
+			pthread_mutex_lock(&r->lock);
+			r->lo = lo;
+			r->hi = hi;
+			pthread_mutex_unlock(&r->lock);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Runs iterations until none are left to take. A thread only stops once
+ * its own range is empty and it found nothing to steal, so when all the
+ * threads have stopped, every iteration has run.
+ */
+static void run(int self)
+{
+	long long lo, hi;
+	inLoop = 1;
+	do {
+		while (takeChunk(self, &lo, &hi)) {
+			pool.body(pool.ctx, (int)lo, (int)hi);
+		}
+	} while (steal(self));
+	__decaf_flush();
+	inLoop = 0;
+}
+
+static void *worker(void *arg)
+{
+	int self = (int)(long)arg;
+	unsigned long seen = 0;
+	pthread_mutex_lock(&pool.lock);
+	for (;;) {
+		while (pool.generation == seen) {
+			pthread_cond_wait(&pool.wake, &pool.lock);
+		}
+		seen = pool.generation;
+		pthread_mutex_unlock(&pool.lock);
+		run(self);
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.busy == 0) {
+			pthread_cond_signal(&pool.done);
+		}
+	}
+	return NULL;
+}
+
+static void startPool(void)
+{
+	const char *env = getenv("DECAF_NUM_THREADS");
+	long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_attr_t attr;
+	int i;
+	if (n < 1) {
+		n = 1;
+	}
+	pool.ranges = calloc(n, sizeof(struct range));
+	if (!pool.ranges) {
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		pthread_mutex_init(&pool.ranges[i].lock, NULL);
+	}
+	pool.threads = 1;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (i = 1; i < n; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, &attr, worker, (void *)(long)i) != 0) {
+			break;
+		}
+		pool.threads++;
+	}
+	pthread_attr_destroy(&attr);
+}
+
+void __decaf_parallel_for(body_fn body, void *ctx, int first, int last)
+{
+	long long count = (long long)last - first + 1;
+	long long per;
+	int i;
+	if (count <= 0) {
+		return;
+	}
+	if (count == 1 || inLoop) {
+		body(ctx, first, last);
+		return;
+	}
+	pthread_once(&started, startPool);
+	if (pool.threads <= 1) {
+		body(ctx, first, last);
+		return;
+	}
+
+	pthread_mutex_lock(&pool.submit);
+	__decaf_flush();			/* Output of the caller so far comes before the loop's */
+	pool.body = body;
+	pool.ctx = ctx;
+	pool.grain = count / (pool.threads * 8);
+	if (pool.grain < 1) {
+		pool.grain = 1;
+	}
+	per = count / pool.threads;
+	for (i = 0; i < pool.threads; i++) {
+		pool.ranges[i].lo = first + per * i + (i < count % pool.threads ? i : count % pool.threads);
+		pool.ranges[i].hi = pool.ranges[i].lo + per - (i < count % pool.threads ? 0 : 1);
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.busy = pool.threads - 1;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.wake);
+	pthread_mutex_unlock(&pool.lock);
+
+	run(0);
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.busy > 0) {
+		pthread_cond_wait(&pool.done, &pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	pthread_mutex_unlock(&pool.submit);
+}
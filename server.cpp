@@ -0,0 +1,336 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include "include/server.h"
+#include "include/driver.h"
+#include "include/emit.h"
+#include "include/stdllvm.h"
+using namespace std;
+using namespace llvm;
+
+static const char *emitNames[] = { "bc", "o", "s", "out" };
+
+string DefaultSocketPath() {
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	if(dir && *dir) {
+		return string(dir) + "/decaf.sock";
+	}
+	return "/tmp/decaf-" + to_string(getuid()) + ".sock";
+}
+
+static bool writeAll(int fd, const char *p, size_t n) {
+	while(n > 0) {
+		ssize_t w = write(fd, p, n);
+		if(w < 0 && errno == EINTR) {
+			continue;
+		}
+		if(w <= 0) {
+			return false;
+		}
+		p += w;
+		n -= w;
+	}
+	return true;
+}
+
+static bool readAll(int fd, char *p, size_t n) {
+	while(n > 0) {
+		ssize_t r = read(fd, p, n);
+		if(r < 0 && errno == EINTR) {
+			continue;
+		}
+		if(r <= 0) {
+			return false;
+		}
+		p += r;
+		n -= r;
+	}
+	return true;
+}
+
+/* Reads one header line, without its '\n'. Headers are short, so byte by byte is fine */
+static bool readLine(int fd, string &line) {
+	line.clear();
+	char c;
+	while(readAll(fd, &c, 1)) {
+		if(c == '\n') {
+			return true;
+		}
+		line.push_back(c);
+	}
+	return false;
+}
+
+static bool readWholeFile(const string &path, string &out) {
+	ifstream in(path.c_str(), ios::binary);
+	if(!in) {
+		return false;
+	}
+	ostringstream s;
+	s << in.rdbuf();
+	out = s.str();
+	return true;
+}
+
+static int connectTo(const string &path) {
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) {
+		return -1;
+	}
+	if(connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Sends "status N\n" and the N bytes of body */
+static void respond(int conn, const char *status, const string &body) {
+	string head = string(status) + " " + to_string(body.size()) + "\n";
+	if(writeAll(conn, head.data(), head.size())) {
+		writeAll(conn, body.data(), body.size());
+	}
+}
+
+/*
+ * Runs in the child forked for the connection. Standard output and error
+ * go to a temporary file for the duration of the compile, so that the
+ * diagnostics can be sent back to the client.
+ */
+static void serveRequest(int conn, TargetMachine **targets, unsigned jobs) {
+	map<string, string> header;
+	string line;
+	while(readLine(conn, line) && !line.empty()) {
+		size_t space = line.find(' ');
+		header[line.substr(0, space)] = space == string::npos ? "" : line.substr(space + 1);
+	}
+
+	CompileOptions opts;
+	opts.optLevel = atoi(header["opt"].c_str());
+	if(opts.optLevel < 0 || opts.optLevel > 3) {
+		opts.optLevel = 2;
+	}
+	opts.pipeline = header["passes"];
+	opts.jobs = jobs;
+	opts.emit = EMIT_BITCODE;
+	for(int k = EMIT_BITCODE; k <= EMIT_EXECUTABLE; k++) {
+		if(header["emit"] == emitNames[k]) {
+			opts.emit = (OutputKind)k;
+		}
+	}
+	opts.target = opts.emit == EMIT_BITCODE ? nullptr : targets[opts.optLevel];
+	opts.cache = nullptr;
+	opts.incremental = false;
+	opts.wholeProgram = header.count("whole-program") > 0;
+
+	FILE *in;
+	string name = header["name"];
+	if(header.count("size")) {
+		string source(strtoul(header["size"].c_str(), nullptr, 10), '\0');
+		if(!readAll(conn, &source[0], source.size())) {
+			return;
+		}
+		in = tmpfile();
+		if(in) {
+			fwrite(source.data(), 1, source.size(), in);
+			rewind(in);
+		}
+	}
+	else {
+		in = fopen(header["path"].c_str(), "r");
+	}
+	if(name.empty()) {
+		name = header["path"];
+	}
+	if(!in) {
+		respond(conn, "error", name + " cannot be opened: " + strerror(errno) + "\n");
+		return;
+	}
+
+	SmallString<128> outPath, diagPath;
+	int diagFD;
+	if(sys::fs::createTemporaryFile("decaf", emitNames[opts.emit], outPath) ||
+	   sys::fs::createTemporaryFile("decaf", "log", diagFD, diagPath)) {
+		respond(conn, "error", "cannot create temporary files on the server\n");
+		return;
+	}
+	dup2(diagFD, 1);
+	dup2(diagFD, 2);
+	close(diagFD);
+
+	int ret;
+	bool ok = CompileStream(in, name, outPath.str(), opts, &ret);
+	fclose(in);
+	cout.flush();
+	cerr.flush();
+	outs().flush();
+	errs().flush();
+	fflush(stdout);
+	fflush(stderr);
+
+	string body;
+	if(!ok) {
+		readWholeFile(diagPath.str(), body);
+		respond(conn, "error", body);
+	}
+	else if(readWholeFile(outPath.str(), body)) {
+		respond(conn, "ok", body);
+	}
+	else {
+		respond(conn, "error", "the server cannot read back its output\n");
+	}
+	sys::fs::remove(outPath.str());
+	sys::fs::remove(diagPath.str());
+}
+
+static char socketToRemove[sizeof(((sockaddr_un *)0)->sun_path)];
+
+static void removeSocketAndExit(int sig) {
+	unlink(socketToRemove);
+	_exit(0);
+}
+
+int RunServer(const string &socketPath, unsigned jobs) {
+	sockaddr_un addr;
+	if(socketPath.size() >= sizeof(addr.sun_path)) {
+		cerr << ProgName << ": Socket path " << socketPath << " is too long" << endl;
+		return 1;
+	}
+	int other = connectTo(socketPath);
+	if(other >= 0) {
+		close(other);
+		cerr << ProgName << ": A server is already listening on " << socketPath << endl;
+		return 1;
+	}
+	unlink(socketPath.c_str());			// Left over by a server that did not exit cleanly
+
+	// The warm state every request starts from
+	InitializeNativeTarget();
+	InitializeNativeTargetAsmPrinter();
+	TargetMachine *targets[4];
+	for(int level = 0; level < 4; level++) {
+		targets[level] = CreateHostTargetMachine(level);
+		if(!targets[level]) {
+			return 1;
+		}
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listener < 0 || bind(listener, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 64) < 0) {
+		cerr << ProgName << ": Cannot listen on " << socketPath << ": " << strerror(errno) << endl;
+		return 1;
+	}
+	strncpy(socketToRemove, socketPath.c_str(), sizeof(socketToRemove) - 1);
+	signal(SIGINT, removeSocketAndExit);
+	signal(SIGTERM, removeSocketAndExit);
+	signal(SIGCHLD, SIG_IGN);			// Children are reaped automatically
+	signal(SIGPIPE, SIG_IGN);			// A client that went away is not our problem
+	cerr << ProgName << ": Listening on " << socketPath << endl;
+
+	while(true) {
+		int conn = accept(listener, nullptr, nullptr);
+		if(conn < 0) {
+			if(errno != EINTR) {
+				cerr << ProgName << ": accept: " << strerror(errno) << endl;
+			}
+			continue;
+		}
+		pid_t pid = fork();
+		if(pid == 0) {
+			close(listener);
+			signal(SIGINT, SIG_DFL);
+			signal(SIGTERM, SIG_DFL);
+			signal(SIGCHLD, SIG_DFL);	// Or the linker would be reaped before --link waits for it
+			serveRequest(conn, targets, jobs);
+			_exit(0);
+		}
+		if(pid < 0) {
+			respond(conn, "error", string("the server cannot fork: ") + strerror(errno) + "\n");
+		}
+		close(conn);
+	}
+}
+
+int RunClient(const string &socketPath, const string &input, const string &output, const CompileOptions &opts) {
+	string source;
+	string head = "opt " + to_string(opts.optLevel) + "\n" +
+				  "emit " + emitNames[opts.emit] + "\n" +
+				  "name " + (input == "-" ? string("<stdin>") : input) + "\n";
+	if(!opts.pipeline.empty()) {
+		head += "passes " + opts.pipeline + "\n";
+	}
+	if(opts.wholeProgram) {
+		head += "whole-program\n";
+	}
+	if(input == "-") {
+		ostringstream s;
+		s << cin.rdbuf();
+		source = s.str();
+		head += "size " + to_string(source.size()) + "\n";
+	}
+	else {
+		// The server has its own working directory
+		char resolved[PATH_MAX];
+		if(!realpath(input.c_str(), resolved)) {
+			cerr << ProgName << ": File " << input << " cannot be opened.\n";
+			return 1;
+		}
+		head += string("path ") + resolved + "\n";
+	}
+	head += "\n";
+
+	int fd = connectTo(socketPath);
+	if(fd < 0) {
+		cerr << ProgName << ": No compile server on " << socketPath << " (start one with --server)" << endl;
+		return 1;
+	}
+	string status;
+	bool sent = writeAll(fd, head.data(), head.size()) && writeAll(fd, source.data(), source.size());
+	if(!sent || !readLine(fd, status)) {
+		cerr << ProgName << ": The compile server closed the connection" << endl;
+		close(fd);
+		return 1;
+	}
+	size_t space = status.find(' ');
+	string body(space == string::npos ? 0 : strtoul(status.c_str() + space + 1, nullptr, 10), '\0');
+	bool complete = readAll(fd, &body[0], body.size());
+	close(fd);
+	if(!complete) {
+		cerr << ProgName << ": Truncated reply from the compile server" << endl;
+		return 1;
+	}
+
+	if(status.compare(0, space, "ok") != 0) {
+		cerr << body;
+		return 1;
+	}
+	ofstream out(output.c_str(), ios::binary);
+	if(!out.write(body.data(), body.size())) {
+		cerr << ProgName << ": Cannot write " << output << endl;
+		return 1;
+	}
+	if(opts.emit == EMIT_EXECUTABLE) {
+		out.close();
+		chmod(output.c_str(), 0755);
+	}
+	return 0;
+}
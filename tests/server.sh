@@ -0,0 +1,44 @@
+#!/bin/sh
+# Compiles the sample programs through a compile server, linking them
+# into executables (--client --link), and checks that they print the same
+# as when they are linked by decaf itself.
+#
+# Usage : tests/server.sh
+# Run from the top of the tree after make.
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/decaf-server.XXXXXX") || exit 1
+socket="$dir/decaf.sock"
+./decaf --server --socket "$socket" 2> "$dir/server.log" &
+server=$!
+trap 'kill $server 2>/dev/null; rm -rf "$dir"' EXIT
+
+tries=0
+while [ ! -S "$socket" ]; do
+	tries=$((tries + 1))
+	if [ $tries -gt 50 ]; then
+		echo "the server did not start:"
+		cat "$dir/server.log"
+		exit 1
+	fi
+	sleep 0.1
+done
+
+status=0
+for t in tests/Test_*; do
+	name=$(basename "$t")
+	if ! ./decaf --client --socket "$socket" --link -o "$dir/$name.client" "$t" ||
+	   ! ./decaf --link -o "$dir/$name.local" "$t"; then
+		echo "FAIL $name : link"
+		status=1
+		continue
+	fi
+	"$dir/$name.client" > "$dir/$name.client.txt"
+	"$dir/$name.local" > "$dir/$name.local.txt"
+	if cmp -s "$dir/$name.client.txt" "$dir/$name.local.txt"; then
+		echo "ok   $name"
+	else
+		echo "FAIL $name : output differs"
+		status=1
+	fi
+done
+exit $status
@@ -0,0 +1,259 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/resource.h>
+#include "include/timing.h"
+#include "include/stdllvm.h"
+using namespace std;
+using namespace llvm;
+
+/*
+ * Where there is no per-thread usage, the CPU time is the process's, and
+ * concurrent compiles show up in each other's phases.
+ */
+#ifndef RUSAGE_THREAD
+#define RUSAGE_THREAD RUSAGE_SELF
+#endif
+
+PhaseTime ThreadTimes() {
+	PhaseTime t;
+	t.wall = chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+	struct rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	t.user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+	t.system = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	return t;
+}
+
+void TimeReport::start(const char *phase) {
+	stop();
+	startTime_ = ThreadTimes();
+	startTime_.name = phase;
+	running_ = true;
+}
+
+void TimeReport::stop() {
+	if(!running_) {
+		return;
+	}
+	PhaseTime end = ThreadTimes();
+	PhaseTime t;
+	t.name = startTime_.name;
+	t.wall = end.wall - startTime_.wall;
+	t.user = end.user - startTime_.user;
+	t.system = end.system - startTime_.system;
+	phases_.push_back(t);
+	running_ = false;
+}
+
+void TimeReport::addCPU(const PhaseTime &t) {
+	if(!phases_.empty()) {
+		phases_.back().user += t.user;
+		phases_.back().system += t.system;
+	}
+}
+
+PhaseTime TimeReport::getTotal() const {
+	PhaseTime total;
+	total.name = "total";
+	total.wall = total.user = total.system = 0;
+	for(unsigned i = 0; i < phases_.size(); i++) {
+		total.wall += phases_[i].wall;
+		total.user += phases_[i].user;
+		total.system += phases_[i].system;
+	}
+	return total;
+}
+
+void EnablePassTiming() {
+	TimePassesIsEnabled = true;
+}
+
+/*
+ * LLVM only prints its timers, so the tables of the pass timing group are
+ * read back. A table has a header naming its columns (user, system,
+ * user+system and wall time, the first three only when not zero), then a
+ * row per pass : every column as "time (percent%)", then the pass name.
+ */
+static void parseTimerTable(const string &text, vector<PhaseTime> &passes) {
+	size_t pos = 0;
+	bool inPasses = false, user = false, system = false, process = false, inRows = false;
+	while(pos < text.size()) {
+		size_t end = text.find('\n', pos);
+		if(end == string::npos) {
+			end = text.size();
+		}
+		string line = text.substr(pos, end - pos);
+		pos = end + 1;
+
+		if(line.find("Pass execution timing report") != string::npos) {
+			inPasses = true;
+			continue;
+		}
+		if(line.find("--- Name ---") != string::npos) {
+			user = line.find("User Time") != string::npos;
+			system = line.find("System Time") != string::npos;
+			process = line.find("User+System") != string::npos;
+			inRows = inPasses;
+			continue;
+		}
+		if(!inRows) {
+			continue;
+		}
+		if(line.find_first_not_of(" \t") == string::npos) {
+			inRows = inPasses = false;
+			continue;
+		}
+
+		double values[4];
+		unsigned columns = user + system + process + 1;
+		const char *p = line.c_str();
+		bool ok = true;
+		for(unsigned c = 0; c < columns && ok; c++) {
+			char *after;
+			values[c] = strtod(p, &after);
+			const char *percent = strstr(after, "%)");
+			ok = after != p && percent;
+			p = ok ? percent + 2 : p;
+		}
+		while(*p == ' ') {
+			p++;
+		}
+		if(!ok || strcmp(p, "Total") == 0) {
+			continue;
+		}
+		PhaseTime t;
+		t.name = p;
+		t.user = user ? values[0] : 0;
+		t.system = system ? values[user] : 0;
+		t.wall = values[columns - 1];
+		passes.push_back(t);
+	}
+}
+
+static bool slowerFirst(const PhaseTime &a, const PhaseTime &b) {
+	return a.wall > b.wall;
+}
+
+/*
+ * Every instance of a pass has a timer of its own (the same pass runs in
+ * every pass manager, for every file), so the times are added up by name.
+ * Some versions of LLVM number the instances ("GVN #2"); the number goes.
+ */
+void TakePassTimings(vector<PhaseTime> &passes) {
+	string text;
+	raw_string_ostream os(text);
+	TimerGroup::printAll(os);
+	os.flush();
+	vector<PhaseTime> timers;
+	parseTimerTable(text, timers);
+
+	map<string, unsigned> byName;
+	for(unsigned i = 0; i < timers.size(); i++) {
+		string name = timers[i].name;
+		size_t hash = name.rfind(" #");
+		if(hash != string::npos && hash + 2 < name.size() &&
+		   name.find_first_not_of("0123456789", hash + 2) == string::npos) {
+			name.erase(hash);
+		}
+		map<string, unsigned>::iterator it = byName.find(name);
+		if(it == byName.end()) {
+			byName[name] = passes.size();
+			passes.push_back(timers[i]);
+			passes.back().name = name;
+		}
+		else {
+			passes[it->second].wall += timers[i].wall;
+			passes[it->second].user += timers[i].user;
+			passes[it->second].system += timers[i].system;
+		}
+	}
+	std::stable_sort(passes.begin(), passes.end(), slowerFirst);
+}
+
+static void printRow(ostream &os, const PhaseTime &t) {
+	char row[256];
+	snprintf(row, sizeof(row), "  %10.3f %10.3f %10.3f  ", t.wall * 1e3, t.user * 1e3, t.system * 1e3);
+	os << row << t.name << "\n";
+}
+
+void PrintTimeReport(ostream &os, const vector<TimeReport> &reports, const vector<PhaseTime> &passes) {
+	for(unsigned i = 0; i < reports.size(); i++) {
+		if(reports[i].getPhases().empty()) {
+			continue;
+		}
+		os << "===-- Time report for " << reports[i].getFile() << " --===\n";
+		os << "   Wall (ms)  User (ms)   Sys (ms)  Phase\n";
+		for(unsigned p = 0; p < reports[i].getPhases().size(); p++) {
+			printRow(os, reports[i].getPhases()[p]);
+		}
+		printRow(os, reports[i].getTotal());
+		os << "\n";
+	}
+	if(!passes.empty()) {
+		os << "===-- LLVM passes" << (reports.size() > 1 ? ", all files" : "") << " --===\n";
+		os << "   Wall (ms)  User (ms)   Sys (ms)  Pass\n";
+		for(unsigned p = 0; p < passes.size(); p++) {
+			printRow(os, passes[p]);
+		}
+		os << "\n";
+	}
+}
+
+static string quote(const string &s) {
+	string out = "\"";
+	for(unsigned i = 0; i < s.size(); i++) {
+		unsigned char c = s[i];
+		if(c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		}
+		else if(c < 0x20) {
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\u%04x", c);
+			out += escape;
+		}
+		else {
+			out += c;
+		}
+	}
+	return out + "\"";
+}
+
+static void printTimes(ostream &os, const vector<PhaseTime> &times, const char *indent) {
+	for(unsigned i = 0; i < times.size(); i++) {
+		char values[128];
+		snprintf(values, sizeof(values), "\"wall\": %.6f, \"user\": %.6f, \"system\": %.6f",
+				 times[i].wall, times[i].user, times[i].system);
+		os << indent << "{\"name\": " << quote(times[i].name) << ", " << values << "}"
+		   << (i + 1 < times.size() ? ",\n" : "\n");
+	}
+}
+
+/* Seconds, as { "files": [ { "file", "phases": [...], "total" } ], "passes": [...] } */
+void PrintTimeReportJSON(ostream &os, const vector<TimeReport> &reports, const vector<PhaseTime> &passes) {
+	os << "{\n  \"files\": [";
+	bool first = true;
+	for(unsigned i = 0; i < reports.size(); i++) {
+		if(reports[i].getPhases().empty()) {
+			continue;
+		}
+		os << (first ? "\n" : ",\n");
+		first = false;
+		os << "    {\n      \"file\": " << quote(reports[i].getFile()) << ",\n      \"phases\": [\n";
+		printTimes(os, reports[i].getPhases(), "        ");
+		os << "      ],\n      \"total\": ";
+		vector<PhaseTime> total(1, reports[i].getTotal());
+		printTimes(os, total, "");
+		os << "    }";
+	}
+	os << "\n  ],\n  \"passes\": [\n";
+	printTimes(os, passes, "    ");
+	os << "  ]\n}\n";
+}
@@ -0,0 +1,209 @@
+#include <map>
+#include <set>
+#include <vector>
+#include "include/wholeprogram.h"
+#include "include/stdllvm.h"
+#include <llvm/Analysis/ValueTracking.h>
+using namespace std;
+using namespace llvm;
+
+/* What a method does to the memory its callers can see, in increasing order */
+enum MemoryEffect {
+	NO_EFFECT,
+	READS_MEMORY,
+	WRITES_MEMORY
+};
+
+/* Adds the globals a constant refers to, through constant expressions */
+static void addReferences(Constant *C, set<GlobalValue *> &live, vector<GlobalValue *> &work) {
+	if(GlobalValue *GV = dyn_cast<GlobalValue>(C)) {
+		if(live.insert(GV).second) {
+			work.push_back(GV);
+		}
+		return;
+	}
+	for(unsigned i = 0; i < C->getNumOperands(); i++) {
+		addReferences(cast<Constant>(C->getOperand(i)), live, work);
+	}
+}
+
+/* The methods and fields that main uses, directly or through other methods */
+static set<GlobalValue *> reachableFrom(Function *main) {
+	set<GlobalValue *> live;
+	vector<GlobalValue *> work;
+	live.insert(main);
+	work.push_back(main);
+	while(!work.empty()) {
+		GlobalValue *GV = work.back();
+		work.pop_back();
+		if(GlobalVariable *G = dyn_cast<GlobalVariable>(GV)) {
+			if(G->hasInitializer()) {
+				addReferences(G->getInitializer(), live, work);
+			}
+			continue;
+		}
+		Function *F = dyn_cast<Function>(GV);
+		if(!F) {
+			continue;
+		}
+		for(inst_iterator I = inst_begin(F); I != inst_end(F); I++) {
+			for(unsigned i = 0; i < I->getNumOperands(); i++) {
+				if(Constant *C = dyn_cast<Constant>(I->getOperand(i))) {
+					addReferences(C, live, work);
+				}
+			}
+		}
+	}
+	return live;
+}
+
+/* Whether a pointer is into the stack frame of the function using it */
+static bool isLocal(Value *P) {
+	return isa<AllocaInst>(GetUnderlyingObject(P));
+}
+
+/*
+ * The effect of a function, given the current effects of the methods it
+ * calls. Loads and stores of its own locals do not count. External
+ * functions have the effect their attributes give, on memory other than
+ * the locals they are passed.
+ */
+static MemoryEffect effectOf(Function &F, const map<Function *, MemoryEffect> &effects) {
+	MemoryEffect effect = NO_EFFECT;
+	for(inst_iterator I = inst_begin(F); I != inst_end(F); I++) {
+		MemoryEffect e = NO_EFFECT;
+		if(LoadInst *LI = dyn_cast<LoadInst>(&*I)) {
+			e = isLocal(LI->getPointerOperand()) ? NO_EFFECT : READS_MEMORY;
+		}
+		else if(StoreInst *SI = dyn_cast<StoreInst>(&*I)) {
+			e = isLocal(SI->getPointerOperand()) ? NO_EFFECT : WRITES_MEMORY;
+		}
+		else if(isa<AtomicRMWInst>(&*I) || isa<AtomicCmpXchgInst>(&*I)) {
+			e = WRITES_MEMORY;
+		}
+		else if(MemIntrinsic *MI = dyn_cast<MemIntrinsic>(&*I)) {
+			if(!isLocal(MI->getDest())) {
+				e = WRITES_MEMORY;
+			}
+			else if(MemTransferInst *MT = dyn_cast<MemTransferInst>(MI)) {
+				e = isLocal(MT->getSource()) ? NO_EFFECT : READS_MEMORY;
+			}
+		}
+		else if(CallInst *CI = dyn_cast<CallInst>(&*I)) {
+			Function *callee = CI->getCalledFunction();
+			map<Function *, MemoryEffect>::const_iterator known = callee ? effects.find(callee) : effects.end();
+			if(known != effects.end()) {
+				e = known->second;
+			}
+			else if(callee && callee->doesNotAccessMemory()) {
+				e = NO_EFFECT;
+			}
+			else if(callee && callee->onlyReadsMemory()) {
+				for(unsigned i = 0; i < CI->getNumArgOperands(); i++) {
+					Value *arg = CI->getArgOperand(i);
+					if(arg->getType()->isPointerTy() && !isLocal(arg)) {
+						e = READS_MEMORY;
+					}
+				}
+			}
+			else {
+				e = WRITES_MEMORY;
+			}
+		}
+		if(e > effect) {
+			effect = e;
+		}
+	}
+	return effect;
+}
+
+void InternalizeProgram(Module *M) {
+	Function *main = M->getFunction("main");
+	if(!main || main->isDeclaration()) {
+		return;
+	}
+
+	// Drop what main does not reach. References between dead methods go first
+	set<GlobalValue *> live = reachableFrom(main);
+	vector<Function *> deadFunctions;
+	for(Module::iterator F = M->begin(); F != M->end(); F++) {
+		if(!F->isDeclaration() && !live.count(&*F)) {
+			F->dropAllReferences();
+			deadFunctions.push_back(&*F);
+		}
+	}
+	for(unsigned i = 0; i < deadFunctions.size(); i++) {
+		deadFunctions[i]->eraseFromParent();
+	}
+	for(Module::global_iterator it = M->global_begin(); it != M->global_end(); ) {
+		GlobalVariable *G = &*it++;
+		if(!live.count(G) && G->use_empty()) {
+			G->eraseFromParent();
+		}
+	}
+	for(Module::iterator it = M->begin(); it != M->end(); ) {
+		Function *F = &*it++;
+		if(F->isDeclaration() && F->use_empty()) {
+			F->eraseFromParent();
+		}
+	}
+
+	// Nothing outside the module refers to the rest of the program
+	for(Module::global_iterator G = M->global_begin(); G != M->global_end(); G++) {
+		if(!G->isDeclaration()) {
+			G->setLinkage(GlobalValue::InternalLinkage);
+		}
+	}
+	for(Module::iterator F = M->begin(); F != M->end(); F++) {
+		if(F->isDeclaration() || &*F == main) {
+			continue;
+		}
+		F->setLinkage(GlobalValue::InternalLinkage);
+		if(!F->hasAddressTaken()) {
+			F->setCallingConv(CallingConv::Fast);
+			for(Value::user_iterator U = F->user_begin(); U != F->user_end(); U++) {
+				cast<CallInst>(*U)->setCallingConv(CallingConv::Fast);
+			}
+		}
+	}
+
+	// A musttail call needs the caller's convention, which main does not change to
+	for(Module::iterator F = M->begin(); F != M->end(); F++) {
+		for(inst_iterator I = inst_begin(&*F); I != inst_end(&*F); I++) {
+			CallInst *CI = dyn_cast<CallInst>(&*I);
+			if(CI && CI->isMustTailCall() && CI->getCallingConv() != F->getCallingConv()) {
+				CI->setTailCallKind(CallInst::TCK_Tail);
+			}
+		}
+	}
+
+	// Effects start out as none and only grow, until no method changes
+	map<Function *, MemoryEffect> effects;
+	for(Module::iterator F = M->begin(); F != M->end(); F++) {
+		if(!F->isDeclaration()) {
+			effects[&*F] = NO_EFFECT;
+		}
+	}
+	bool changed = true;
+	while(changed) {
+		changed = false;
+		for(map<Function *, MemoryEffect>::iterator it = effects.begin(); it != effects.end(); it++) {
+			MemoryEffect e = effectOf(*it->first, effects);
+			if(e != it->second) {
+				it->second = e;
+				changed = true;
+			}
+		}
+	}
+	// Decaf has no exceptions, and callouts are C functions, so nothing unwinds
+	for(map<Function *, MemoryEffect>::iterator it = effects.begin(); it != effects.end(); it++) {
+		Function *F = it->first;
+		F->setDoesNotThrow();
+		if(it->second == NO_EFFECT) {
+			F->setDoesNotAccessMemory();
+		}
+		else if(it->second == READS_MEMORY) {
+			F->setOnlyReadsMemory();
+		}
+	}
+}